@@ -0,0 +1,201 @@
+/*
+ * acceptbench.c - Accept rate of one shared or many sharded listeners
+ *
+ * usage: acceptbench [-h] [-t <secs>] [-c <clients>] [-w <workers>]
+ * A child process runs <clients> threads that connect to the server
+ * over loopback and reset each connection at once (so no TIME_WAIT
+ * sockets pile up), as fast as they can. The server accepts with
+ * <workers> threads (default: runs with 1, 4 and 16) in two ways:
+ *     shared     every worker accepts from one open_listenfd socket
+ *     reuseport  each worker has its own socket from open_listenfds
+ * and prints the connections accepted per second over <secs> seconds
+ * and how evenly the workers shared them.
+ */
+#define _GNU_SOURCE         /* for accept4 */
+#include "csapp.h"
+
+#define MAXWORKERS 64
+
+int secs = 2;               /* measuring time per run */
+int nclients = 16;          /* client threads */
+int port;                   /* port of the current run */
+volatile int stopping;      /* workers should return */
+
+struct {                    /* accepts of each worker, one cache line each */
+    volatile long n;
+    char pad[56];
+} counts[MAXWORKERS];
+
+struct worker_t {
+    int id;
+    int listenfd;
+};
+
+/* now - Return the monotonic clock in seconds */
+double now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* connector - Client thread: connect and reset, over and over */
+void *connector(void *vargp)
+{
+    struct linger lg = {1, 0};
+    int fd;
+
+    for (;;) {
+        if ((fd = open_clientfd("localhost", port)) < 0)
+            continue;       /* queue full: try again */
+        setsockopt(fd, SOL_SOCKET, SO_LINGER, &lg, sizeof(lg));
+        close(fd);
+    }
+    return NULL;
+}
+
+/* connectors - Start the client child process */
+pid_t connectors(void)
+{
+    pthread_t tid;
+    pid_t pid;
+    int i;
+
+    fflush(stdout);
+    if ((pid = Fork()) > 0)
+        return pid;
+    for (i = 0; i < nclients; i++)
+        Pthread_create(&tid, NULL, connector, NULL);
+    for (;;)
+        pause();
+}
+
+/* acceptor - Worker thread: accept and close until stopped */
+void *acceptor(void *vargp)
+{
+    struct worker_t *w = vargp;
+    int fd;
+
+    while (!stopping) {
+        if ((fd = accept4(w->listenfd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC)) < 0) {
+            if (errno == EINTR || errno == ECONNABORTED)
+                continue;
+            break;          /* shut down */
+        }
+        close(fd);
+        counts[w->id].n++;
+    }
+    return NULL;
+}
+
+long total(int nworkers)
+{
+    long n = 0;
+    int i;
+
+    for (i = 0; i < nworkers; i++)
+        n += counts[i].n;
+    return n;
+}
+
+/* run - Measure the accept rate of nworkers workers */
+void run(int nworkers, int sharded)
+{
+    struct worker_t w[MAXWORKERS];
+    pthread_t tids[MAXWORKERS];
+    int fds[MAXWORKERS], i, nfds;
+    struct sockaddr_storage addr;
+    socklen_t len = sizeof(addr);
+    char service[NI_MAXSERV];
+    long before[MAXWORKERS], n, min, max;
+    double start, elapsed;
+    pid_t pid;
+
+    nfds = sharded ? nworkers : 1;
+    if (sharded)
+        Open_listenfds(0, fds, nworkers);
+    else
+        fds[0] = Open_listenfd(0);
+    if (getsockname(fds[0], (SA *)&addr, &len) < 0)
+        unix_error("getsockname error");
+    Getnameinfo((SA *)&addr, len, NULL, 0, service, sizeof(service), NI_NUMERICSERV);
+    port = atoi(service);
+
+    /* the client child is forked before there are other threads */
+    pid = connectors();
+    stopping = 0;
+    for (i = 0; i < nworkers; i++) {
+        counts[i].n = 0;
+        w[i].id = i;
+        w[i].listenfd = fds[sharded ? i : 0];
+        Pthread_create(&tids[i], NULL, acceptor, &w[i]);
+    }
+
+    usleep(200000);         /* warm up */
+    for (i = 0; i < nworkers; i++)
+        before[i] = counts[i].n;
+    start = now();
+    sleep(secs);
+    elapsed = now() - start;
+    n = total(nworkers);
+    min = max = counts[0].n - before[0];
+    for (i = 0; i < nworkers; i++) {
+        n -= before[i];
+        if (counts[i].n - before[i] < min)
+            min = counts[i].n - before[i];
+        if (counts[i].n - before[i] > max)
+            max = counts[i].n - before[i];
+    }
+
+    Kill(pid, SIGKILL);
+    Waitpid(pid, NULL, 0);
+    stopping = 1;
+    for (i = 0; i < nfds; i++)
+        shutdown(fds[i], SHUT_RDWR);    /* wakes the workers in accept */
+    for (i = 0; i < nworkers; i++)
+        Pthread_join(tids[i], NULL);
+    for (i = 0; i < nfds; i++)
+        Close(fds[i]);
+
+    printf("%-8d %-10s %12.0f %10ld %10ld\n", nworkers, sharded ? "reuseport" : "shared",
+           n / elapsed, min, max);
+}
+
+void usage(char *prog)
+{
+    printf("Usage: %s [-h] [-t <secs>] [-c <clients>] [-w <workers>]\n", prog);
+    printf("   -h            print this message\n");
+    printf("   -t <secs>     measuring time per run (default 2)\n");
+    printf("   -c <clients>  client threads (default 16)\n");
+    printf("   -w <workers>  only run with this many workers\n");
+    exit(1);
+}
+
+int main(int argc, char **argv)
+{
+    int c, i, nworkers = 0;
+    int sizes[] = {1, 4, 16};
+
+    while ((c = getopt(argc, argv, "ht:c:w:")) != EOF) {
+        switch (c) {
+        case 't': secs = atoi(optarg); break;
+        case 'c': nclients = atoi(optarg); break;
+        case 'w': nworkers = atoi(optarg); break;
+        default:  usage(argv[0]);
+        }
+    }
+    if (optind != argc || secs < 1 || nclients < 1 || nworkers < 0 ||
+        nworkers > MAXWORKERS)
+        usage(argv[0]);
+
+    printf("%-8s %-10s %12s %10s %10s\n", "workers", "listener", "conns/s",
+           "minworker", "maxworker");
+    for (i = 0; i < 3; i++) {
+        if (nworkers > 0 && i > 0)
+            break;
+        run(nworkers > 0 ? nworkers : sizes[i], 0);
+        run(nworkers > 0 ? nworkers : sizes[i], 1);
+    }
+    exit(0);
+}
@@ -1,5 +1,20 @@
 /* $begin csapp.c */
+#ifdef __linux__
+#define _GNU_SOURCE     /* for splice */
+#endif
 #include "csapp.h"
+#include <limits.h>
+#ifdef __linux__
+#include <stdint.h>
+#include <sys/syscall.h>
+#include <sys/sendfile.h>
+#include <poll.h>
+#include <linux/io_uring.h>
+#include <sys/eventfd.h>
+#include <linux/futex.h>
+#define RIO_URING       /* build the io_uring backend */
+#define RIO_ZEROCOPY    /* build sendfile and splice transfers */
+#endif
 
 /************************** 
  * Error-handling functions
@@ -25,6 +40,12 @@ void dns_error(char *msg) /* dns-style error */
     exit(0);
 }
 
+void eai_error(int code, char *msg) /* getaddrinfo-style error */
+{
+    fprintf(stderr, "%s: %s\n", msg, gai_strerror(code));
+    exit(0);
+}
+
 void app_error(char *msg) /* application error */
 {
     fprintf(stderr, "%s\n", msg);
@@ -417,6 +438,17 @@ int Accept(int s, struct sockaddr *addr, socklen_t *addrlen)
     return rc;
 }
 
+#ifdef __linux__
+int Accept4(int s, struct sockaddr *addr, socklen_t *addrlen, int flags) 
+{
+    int rc;
+
+    if ((rc = accept4(s, addr, addrlen, flags)) < 0)
+  unix_error("Accept4 error");
+    return rc;
+}
+#endif
+
 void Connect(int sockfd, struct sockaddr *serv_addr, int addrlen) 
 {
     int rc;
@@ -429,6 +461,31 @@ void Connect(int sockfd, struct sockaddr *serv_addr, int addrlen)
  * DNS interface wrappers 
  ***********************/
 
+/* $begin getaddrinfo */
+void Getaddrinfo(const char *node, const char *service,
+                 const struct addrinfo *hints, struct addrinfo **res)
+{
+    int rc;
+
+    if ((rc = getaddrinfo(node, service, hints, res)) != 0)
+  eai_error(rc, "Getaddrinfo error");
+}
+/* $end getaddrinfo */
+
+void Getnameinfo(const struct sockaddr *sa, socklen_t salen, char *host,
+                 size_t hostlen, char *serv, size_t servlen, int flags)
+{
+    int rc;
+
+    if ((rc = getnameinfo(sa, salen, host, hostlen, serv, servlen, flags)) != 0)
+  eai_error(rc, "Getnameinfo error");
+}
+
+void Freeaddrinfo(struct addrinfo *res)
+{
+    freeaddrinfo(res);
+}
+
 /* $begin gethostbyname */
 struct hostent *Gethostbyname(const char *name) 
 {
@@ -572,6 +629,358 @@ ssize_t rio_writen(int fd, void *usrbuf, size_t n)
 }
 /* $end rio_writen */
 
+/*
+ * rio_copyfd - Copy n bytes from in_fd to out_fd through a buffer,
+ *    reading from *offset and advancing it if offset is not NULL.
+ *    The fallback of the transfers below. Returns the number of
+ *    bytes copied, fewer only at EOF, or -1 on error.
+ */
+static ssize_t rio_copyfd(int out_fd, int in_fd, off_t *offset, size_t n)
+{
+    char buf[MAXBUF];
+    size_t nleft = n;
+    ssize_t nread;
+
+    while (nleft > 0) {
+  nread = nleft < sizeof(buf) ? nleft : sizeof(buf);
+  if (offset != NULL)
+      nread = pread(in_fd, buf, nread, *offset);
+  else
+      nread = read(in_fd, buf, nread);
+  if (nread < 0) {
+      if (errno == EINTR) /* interrupted by sig handler return */
+    continue;
+      return -1;
+  }
+  if (nread == 0)
+      break;              /* EOF */
+  if (rio_writen(out_fd, buf, nread) < 0)
+      return -1;
+  if (offset != NULL)
+      *offset += nread;
+  nleft -= nread;
+    }
+    return n - nleft;
+}
+
+/*
+ * rio_sendfile - Robustly send n bytes of the file in_fd to out_fd
+ *    with sendfile(2), which copies them inside the kernel. Reads from
+ *    *offset and advances it, or from the file offset of in_fd if
+ *    offset is NULL. Resumes after partial transfers and EINTR, and
+ *    copies through a buffer where sendfile is not supported. Returns
+ *    n, fewer only at the end of the file or when a nonblocking out_fd
+ *    is full, or -1 on error (EAGAIN if nothing was sent).
+ */
+ssize_t rio_sendfile(int out_fd, int in_fd, off_t *offset, size_t n)
+{
+    size_t nleft = n;
+    ssize_t nsent;
+
+#ifdef RIO_ZEROCOPY
+    while (nleft > 0) {
+  if ((nsent = sendfile(out_fd, in_fd, offset, nleft)) < 0) {
+      if (errno == EINTR) /* interrupted by sig handler return */
+    continue;
+      if (errno == EAGAIN && nleft < n)
+    return n - nleft;   /* out_fd is full for now */
+      if (errno != EINVAL && errno != ENOSYS)
+    return -1;
+      break;              /* not supported: copy the rest */
+  }
+  if (nsent == 0)
+      return n - nleft;   /* EOF */
+  nleft -= nsent;
+    }
+#endif
+    if (nleft > 0 && (nsent = rio_copyfd(out_fd, in_fd, offset, nleft)) < 0)
+  return -1;
+    return nleft > 0 ? n - nleft + nsent : n;
+}
+
+#ifdef RIO_ZEROCOPY
+static pthread_key_t rio_pipekey;
+static pthread_once_t rio_pipeonce = PTHREAD_ONCE_INIT;
+
+/* rio_pipeclose - Close the pipe of rio_splice when its thread exits */
+static void rio_pipeclose(void *vargp)
+{
+    int *fds = vargp;
+
+    close(fds[0]);
+    close(fds[1]);
+    free(fds);
+}
+
+static void rio_pipekeyinit(void)
+{
+    pthread_key_create(&rio_pipekey, rio_pipeclose);
+}
+
+/*
+ * rio_pipe - Return the pipe rio_splice moves data through in this
+ *    thread, made on first use and kept until the thread exits, or
+ *    NULL with errno set. The pipe is empty between calls.
+ */
+static int *rio_pipe(void)
+{
+    int *fds;
+
+    pthread_once(&rio_pipeonce, rio_pipekeyinit);
+    if ((fds = pthread_getspecific(rio_pipekey)) != NULL)
+  return fds;
+    if ((fds = malloc(2 * sizeof(int))) == NULL)
+  return NULL;
+    if (pipe2(fds, O_CLOEXEC) < 0) {
+  free(fds);
+  return NULL;
+    }
+    pthread_setspecific(rio_pipekey, fds);
+    return fds;
+}
+
+/*
+ * rio_pipedrop - Throw away the pipe of this thread after an error
+ *    that may have left bytes in it; the next call makes a new one.
+ */
+static void rio_pipedrop(int *fds)
+{
+    int olderrno = errno;
+
+    pthread_setspecific(rio_pipekey, NULL);
+    rio_pipeclose(fds);
+    errno = olderrno;
+}
+
+/*
+ * rio_drain - Move n bytes from the pipe fd to out_fd, by splice or,
+ *    if out_fd cannot splice, through a buffer. A nonblocking out_fd
+ *    is waited on with poll, since these bytes have already left
+ *    in_fd and would be lost otherwise. Returns 0 or -1 on error.
+ */
+static int rio_drain(int out_fd, int fd, size_t n)
+{
+    char buf[MAXBUF];
+    struct pollfd pfd = {out_fd, POLLOUT, 0};
+    ssize_t nout, nbuf = 0, nsent = 0;
+    int copy = 0;
+
+    while (n > 0 || nsent < nbuf) {
+  if (copy && nsent == nbuf) {    /* refill the buffer */
+      if ((nbuf = read(fd, buf, n < sizeof(buf) ? n : sizeof(buf))) < 0) {
+    nbuf = 0;
+    if (errno == EINTR)
+        continue;
+    return -1;
+      }
+      nsent = 0;
+      n -= nbuf;
+  }
+  if (copy)
+      nout = write(out_fd, buf + nsent, nbuf - nsent);
+  else
+      nout = splice(fd, NULL, out_fd, NULL, n, SPLICE_F_MOVE | SPLICE_F_MORE);
+  if (nout < 0) {
+      if (errno == EINVAL && !copy)
+    copy = 1;       /* out_fd cannot splice */
+      else if (errno == EAGAIN)
+    poll(&pfd, 1, -1);
+      else if (errno != EINTR)
+    return -1;
+      continue;
+  }
+  if (copy)
+      nsent += nout;
+  else
+      n -= nout;
+    }
+    return 0;
+}
+#endif
+
+/*
+ * rio_splice - Robustly move n bytes from in_fd to out_fd with
+ *    splice(2) through a pipe, so they never reach user space. Works
+ *    where sendfile does not, e.g. from one socket to another. offset
+ *    is as for rio_sendfile, and must be NULL if in_fd is a pipe or a
+ *    socket. Copies through a buffer where splice is not supported.
+ *    The pipe belongs to the calling thread and is reused by its next
+ *    call. Every byte taken from in_fd reaches out_fd before the call
+ *    returns, so a nonblocking out_fd may be waited on for up to a
+ *    pipe's worth; a nonblocking in_fd that runs dry ends the call
+ *    early. Returns n, fewer only at EOF or when a nonblocking in_fd
+ *    has no more for now, or -1 on error (EAGAIN if nothing moved).
+ */
+ssize_t rio_splice(int out_fd, int in_fd, off_t *offset, size_t n)
+{
+    size_t nleft = n;
+    ssize_t nin;
+#ifdef RIO_ZEROCOPY
+    int *fds;
+
+    if ((fds = rio_pipe()) == NULL)
+  return -1;
+    while (nleft > 0) {
+  if ((nin = splice(in_fd, offset, fds[1], NULL, nleft, SPLICE_F_MOVE)) < 0) {
+      if (errno == EINTR) /* interrupted by sig handler return */
+    continue;
+      if (errno == EAGAIN && nleft < n)
+    return n - nleft;   /* in_fd has no more for now */
+      if (errno != EINVAL)
+    return -1;
+      break;              /* in_fd cannot splice: copy the rest */
+  }
+  if (nin == 0)
+      return n - nleft;   /* EOF */
+  if (rio_drain(out_fd, fds[0], nin) < 0) {
+      rio_pipedrop(fds);
+      return -1;
+  }
+  nleft -= nin;
+    }
+    if (nleft == 0)
+  return n;
+#endif
+    if ((nin = rio_copyfd(out_fd, in_fd, offset, nleft)) < 0)
+  return -1;
+    return n - nleft + nin;
+}
+
+
+/* Bytes of a file mapped at a time (at most INT_MAX) */
+#ifndef RIO_MAPWINDOW
+#define RIO_MAPWINDOW (16 << 20)
+#endif
+
+/* Heap buffers grow after this many full reads in a row... */
+#define RIO_GROWAFTER   2
+/* ...and shrink after this many reads that used at most a quarter */
+#define RIO_SHRINKAFTER 8
+
+/*
+ * rio_resize - Move the unread bytes of rp to the start of its buffer
+ *    and, if it is a heap buffer, resize it to size (within its limits).
+ *    The buffer is left as it is if realloc fails.
+ */
+static void rio_resize(rio_t *rp, size_t size)
+{
+    char *base;
+
+    if (rp->rio_map != NULL)
+  return;   /* a mapping is read-only */
+    if (rp->rio_cnt > 0 && rp->rio_bufptr != rp->rio_base)
+  memmove(rp->rio_base, rp->rio_bufptr, rp->rio_cnt);
+    rp->rio_bufptr = rp->rio_base;
+    if (rp->rio_maxsize == 0)
+  return;   /* not ours to resize */
+    if (size < rp->rio_minsize)
+  size = rp->rio_minsize;
+    if (size > rp->rio_maxsize)
+  size = rp->rio_maxsize;
+    if (size < rp->rio_cnt || size == rp->rio_size)
+  return;
+    if ((base = realloc(rp->rio_base, size)) != NULL) {
+  rp->rio_base = rp->rio_bufptr = base;
+  rp->rio_size = size;
+    }
+    rp->rio_nfull = rp->rio_nshort = 0;
+}
+
+/*
+ * rio_alloc - Give rp its heap buffer back if rio_idleb freed it.
+ *    Returns 0, or -1 and sets errno.
+ */
+static int rio_alloc(rio_t *rp)
+{
+    if (rp->rio_base != NULL || rp->rio_map != NULL)
+  return 0;
+    if ((rp->rio_base = malloc(rp->rio_minsize)) == NULL)
+  return -1;
+    rp->rio_bufptr = rp->rio_base;
+    rp->rio_size = rp->rio_minsize;
+    rp->rio_nfull = rp->rio_nshort = 0;
+    return 0;
+}
+
+/*
+ * rio_mapat - Map the window of the file of rp that starts at file
+ *    offset off and make its bytes the unread bytes of rp. Near the
+ *    end of the file, looks again at its size in case it has grown.
+ *    Returns the number of unread bytes, 0 on EOF, -1 on error.
+ */
+static ssize_t rio_mapat(rio_t *rp, off_t off)
+{
+    struct stat st;
+    off_t start;
+    size_t len;
+    char *map;
+
+    if (off + RIO_MAPWINDOW > rp->rio_mapend) {
+  if (fstat(rp->rio_fd, &st) < 0)
+      return -1;
+  rp->rio_mapend = st.st_size;
+  if (off >= rp->rio_mapend) {
+      rp->rio_bufptr = rp->rio_map + (off - rp->rio_mapoff);
+      rp->rio_cnt = 0;
+      return 0;   /* EOF */
+  }
+    }
+    start = off - off % sysconf(_SC_PAGESIZE);
+    len = off - start + RIO_MAPWINDOW;
+    if (len > rp->rio_mapend - start)
+  len = rp->rio_mapend - start;
+    if ((map = mmap(NULL, len, PROT_READ, MAP_PRIVATE, rp->rio_fd, start)) == MAP_FAILED)
+  return -1;
+    madvise(map, len, MADV_SEQUENTIAL);
+    if (rp->rio_map != NULL)
+  munmap(rp->rio_map, rp->rio_maplen);
+    rp->rio_map = map;
+    rp->rio_maplen = len;
+    rp->rio_mapoff = start;
+    rp->rio_base = rp->rio_bufptr = map + (off - start);
+    rp->rio_size = RIO_MAPWINDOW;
+    rp->rio_cnt = len - (off - start);
+    return rp->rio_cnt;
+}
+
+/* rio_mapnext - File offset of the next unread byte of a mapped rp */
+static off_t rio_mapnext(rio_t *rp)
+{
+    return rp->rio_mapoff + (rp->rio_bufptr - rp->rio_map);
+}
+
+/*
+ * rio_fill - Refill the internal buffer of rp if it is empty.
+ *    Returns the number of unread bytes, 0 on EOF, -1 on error.
+ *    A heap buffer doubles when reads keep filling it and halves
+ *    when they keep using little of it.
+ */
+static ssize_t rio_fill(rio_t *rp)
+{
+    if (rp->rio_map != NULL)    /* slide the window instead */
+  return rp->rio_cnt > 0 ? rp->rio_cnt : rio_mapat(rp, rio_mapnext(rp));
+    if (rp->rio_cnt <= 0 && rio_alloc(rp) < 0)
+  return -1;
+    while (rp->rio_cnt <= 0) {  /* refill if buf is empty */
+  if (rp->rio_nfull >= RIO_GROWAFTER)
+      rio_resize(rp, rp->rio_size * 2);
+  else if (rp->rio_nshort >= RIO_SHRINKAFTER)
+      rio_resize(rp, rp->rio_size / 2);
+  rp->rio_cnt = read(rp->rio_fd, rp->rio_base, rp->rio_size);
+  if (rp->rio_cnt < 0) {
+      if (errno != EINTR) /* interrupted by sig handler return */
+    return -1;
+  }
+  else if (rp->rio_cnt == 0)  /* EOF */
+      return 0;
+  else {
+      rp->rio_bufptr = rp->rio_base; /* reset buffer ptr */
+      rp->rio_nfull = rp->rio_cnt == rp->rio_size ? rp->rio_nfull + 1 : 0;
+      rp->rio_nshort = rp->rio_cnt <= rp->rio_size / 4 ? rp->rio_nshort + 1 : 0;
+  }
+    }
+    return rp->rio_cnt;
+}
 
 /* 
  * rio_read - This is a wrapper for the Unix read() function that
@@ -586,18 +995,8 @@ static ssize_t rio_read(rio_t *rp, char *usrbuf, size_t n)
 {
     int cnt;
 
-    while (rp->rio_cnt <= 0) {  /* refill if buf is empty */
-  rp->rio_cnt = read(rp->rio_fd, rp->rio_buf, 
-         sizeof(rp->rio_buf));
-  if (rp->rio_cnt < 0) {
-      if (errno != EINTR) /* interrupted by sig handler return */
-    return -1;
-  }
-  else if (rp->rio_cnt == 0)  /* EOF */
-      return 0;
-  else 
-      rp->rio_bufptr = rp->rio_buf; /* reset buffer ptr */
-    }
+    if ((cnt = rio_fill(rp)) <= 0)
+  return cnt;
 
     /* Copy min(n, rp->rio_cnt) bytes from internal buf to user buf */
     cnt = n;          
@@ -610,18 +1009,131 @@ static ssize_t rio_read(rio_t *rp, char *usrbuf, size_t n)
 }
 /* $end rio_read */
 
+/* rio_reset - Associate a descriptor with rp, which has no buffer yet */
+static void rio_reset(rio_t *rp, int fd)
+{
+    rp->rio_fd = fd;  
+    rp->rio_cnt = 0;  
+    rp->rio_bufptr = rp->rio_base = NULL;
+    rp->rio_size = 0;
+    rp->rio_minsize = rp->rio_maxsize = 0;
+    rp->rio_nfull = rp->rio_nshort = 0;
+    rp->rio_partial = 0;
+    rp->rio_bufindex = -1;
+    rp->rio_inring = rp->rio_ringres = 0;
+    rp->rio_map = NULL;
+    rp->rio_maplen = 0;
+    rp->rio_mapoff = rp->rio_mapend = 0;
+}
+
 /*
  * rio_readinitb - Associate a descriptor with a read buffer and reset buffer
  */
 /* $begin rio_readinitb */
 void rio_readinitb(rio_t *rp, int fd) 
 {
-    rp->rio_fd = fd;  
-    rp->rio_cnt = 0;  
-    rp->rio_bufptr = rp->rio_buf;
+    rio_reset(rp, fd);
+    rp->rio_bufptr = rp->rio_base = rp->rio_buf;
+    rp->rio_size = sizeof(rp->rio_buf);
 }
 /* $end rio_readinitb */
 
+/*
+ * rio_readinitbuf - Like rio_readinitb, but read through the caller's
+ *    buffer of any size (up to INT_MAX bytes are used) instead of the
+ *    one inside rp
+ */
+void rio_readinitbuf(rio_t *rp, int fd, void *buf, size_t size)
+{
+    rio_reset(rp, fd);
+    rp->rio_bufptr = rp->rio_base = buf;
+    rp->rio_size = size < INT_MAX ? size : INT_MAX;
+}
+
+/*
+ * rio_readinitheap - Like rio_readinitb, but read through a heap buffer
+ *    that starts at minsize bytes and grows up to maxsize while reads
+ *    keep filling it, but no further than INT_MAX. Returns -1 and sets
+ *    errno on error. Release the buffer with rio_freeb.
+ */
+int rio_readinitheap(rio_t *rp, int fd, size_t minsize, size_t maxsize)
+{
+    if (minsize == 0 || maxsize < minsize || minsize > INT_MAX) {
+  errno = EINVAL;
+  return -1;
+    }
+    rio_reset(rp, fd);
+    rp->rio_minsize = minsize;
+    rp->rio_maxsize = maxsize < INT_MAX ? maxsize : INT_MAX;
+    return rio_alloc(rp);
+}
+
+/*
+ * rio_readinitmmap - Like rio_readinitb, but if fd is a regular file,
+ *    map it RIO_MAPWINDOW bytes at a time, starting at its current
+ *    offset, and serve the reads straight from the mapping instead of
+ *    copying it through a buffer. The window slides along the file as
+ *    it is read, and reads at the end of the file see data appended
+ *    to it since. Other descriptors, empty files and files that cannot
+ *    be mapped are read as usual. The offset of fd does not move until
+ *    rio_freeb, which must be called to unmap the file. Returns 1 if
+ *    the file is mapped, 0 if not, -1 and sets errno on error.
+ *    Truncating the file while it is mapped raises SIGBUS.
+ */
+int rio_readinitmmap(rio_t *rp, int fd)
+{
+    struct stat st;
+    off_t off;
+
+    rio_reset(rp, fd);
+    if (fstat(fd, &st) < 0)
+  return -1;
+    if (S_ISREG(st.st_mode) && (off = lseek(fd, 0, SEEK_CUR)) >= 0 && off < st.st_size) {
+  rp->rio_mapend = st.st_size;
+  if (rio_mapat(rp, off) >= 0)
+      return 1;
+  rio_reset(rp, fd);
+    }
+    rio_readinitb(rp, fd);
+    return 0;
+}
+
+/*
+ * rio_idleb - Free a heap buffer that holds no unread bytes, or else
+ *    shrink it to fit them; the next read allocates it again. Servers
+ *    call it on connections that go idle, so that these hold no
+ *    buffer. Buffers registered with a ring are kept.
+ */
+void rio_idleb(rio_t *rp)
+{
+    if (rp->rio_cnt <= 0 && rp->rio_maxsize > 0 && rp->rio_map == NULL &&
+  rp->rio_bufindex < 0 && !rp->rio_inring) {
+  free(rp->rio_base);
+  rp->rio_bufptr = rp->rio_base = NULL;
+  rp->rio_size = 0;
+  rp->rio_cnt = 0;
+  return;
+    }
+    rio_resize(rp, rp->rio_cnt > 0 ? rp->rio_cnt : 0);
+}
+
+/*
+ * rio_freeb - Free the heap buffer of rp, or unmap its file and move
+ *    the file offset to the next unread byte (but not close its fd).
+ *    Call it on every rp set up by rio_readinitheap or rio_readinitmmap.
+ *    rp then reads through its own buffer, as after rio_readinitb.
+ */
+void rio_freeb(rio_t *rp)
+{
+    if (rp->rio_map != NULL) {
+  lseek(rp->rio_fd, rio_mapnext(rp), SEEK_SET);
+  munmap(rp->rio_map, rp->rio_maplen);
+    }
+    else if (rp->rio_maxsize > 0)
+  free(rp->rio_base);
+    rio_readinitb(rp, rp->rio_fd);
+}
+
 /*
  * rio_readnb - Robustly read n bytes (buffered)
  */
@@ -650,141 +1162,2170 @@ ssize_t rio_readnb(rio_t *rp, void *usrbuf, size_t n)
 
 /* 
  * rio_readlineb - robustly read a text line (buffered)
+ *    Scans the internal buffer for the newline with memchr and copies
+ *    whole spans, refilling only when a line crosses the end of the
+ *    buffer. Returns what the original byte-at-a-time loop returned:
+ *    the line length if it ends in a newline, one more than the number
+ *    of bytes copied if it was cut short by EOF or maxlen, 0 on EOF.
  */
 /* $begin rio_readlineb */
 ssize_t rio_readlineb(rio_t *rp, void *usrbuf, size_t maxlen) 
 {
-    int n, rc;
-    char c, *bufp = usrbuf;
+    size_t n = 1, cnt;  /* n is one more than the bytes copied so far */
+    ssize_t rc;
+    char *bufp = usrbuf, *nl = NULL;
 
-    for (n = 1; n < maxlen; n++) { 
-      if ((rc = rio_read(rp, &c, 1)) == 1) {
-          *bufp++ = c;
-          if (c == '\n')
-            break;
-      } else if (rc == 0) {
+    while (n < maxlen) {
+      if ((rc = rio_fill(rp)) < 0)
+          return -1;    /* error */
+      if (rc == 0) {
           if (n == 1)
             return 0; /* EOF, no data read */
           else
             break;    /* EOF, some data was read */
-      } else
-          return -1;    /* error */
+      }
+      cnt = maxlen - n;
+      if (rp->rio_cnt < cnt)
+          cnt = rp->rio_cnt;
+      if ((nl = memchr(rp->rio_bufptr, '\n', cnt)) != NULL)
+          cnt = nl - rp->rio_bufptr + 1;
+      memcpy(bufp, rp->rio_bufptr, cnt);
+      rp->rio_bufptr += cnt;
+      rp->rio_cnt -= cnt;
+      bufp += cnt;
+      n += cnt;
+      if (nl != NULL) {
+          n--;          /* the newline ends the line */
+          break;
+      }
     }
     *bufp = 0;
     return n;
 }
 /* $end rio_readlineb */
 
-/**********************************
- * Wrappers for robust I/O routines
- **********************************/
-ssize_t Rio_readn(int fd, void *ptr, size_t nbytes) 
+/*
+ * rio_fillmore - Move the unread bytes of rp to the start of its
+ *    buffer, growing a full heap buffer, and read more behind them.
+ *    Returns the number of bytes added, 0 on EOF or if the buffer is
+ *    full, -1 on error.
+ */
+static ssize_t rio_fillmore(rio_t *rp)
 {
-    ssize_t n;
-  
-    if ((n = rio_readn(fd, ptr, nbytes)) < 0)
-  unix_error("Rio_readn error");
-    return n;
+    ssize_t nread;
+
+    if (rp->rio_cnt <= 0)
+  return rio_fill(rp);
+    if (rp->rio_map != NULL) {  /* map the window from the next byte on */
+  nread = rp->rio_cnt;
+  if (nread == rp->rio_size)
+      return 0;
+  if (rio_mapat(rp, rio_mapnext(rp)) < 0)
+      return -1;
+  return rp->rio_cnt - nread;
+    }
+    if (rp->rio_cnt == rp->rio_size)
+  rio_resize(rp, rp->rio_size * 2);  /* grows heap buffers only */
+    else if (rp->rio_bufptr != rp->rio_base)
+  rio_resize(rp, rp->rio_size);      /* just moves the bytes */
+    if (rp->rio_cnt == rp->rio_size)
+  return 0;
+    while ((nread = read(rp->rio_fd, rp->rio_base + rp->rio_cnt,
+       rp->rio_size - rp->rio_cnt)) < 0) {
+  if (errno != EINTR) /* interrupted by sig handler return */
+      return -1;
+    }
+    rp->rio_cnt += nread;
+    return nread;
 }
 
-void Rio_writen(int fd, void *usrbuf, size_t n) 
-{
-    if (rio_writen(fd, usrbuf, n) != n)
-  unix_error("Rio_writen error");
+/*
+ * rio_viewlineb - Return the next text line in place (buffered)
+ *    Points *linep at the next line, newline included, inside the
+ *    internal buffer and returns its length, or 0 on EOF. The line is
+ *    not NUL-terminated and stays valid until the next call on rp.
+ *    A heap buffer grows to hold a long line; a line that still does
+ *    not fit is copied into usrbuf as by rio_readlineb instead, and
+ *    *linep points there; if usrbuf is NULL it is returned in
+ *    buffer-sized pieces.
+ */
+/* $begin rio_viewlineb */
+ssize_t rio_viewlineb(rio_t *rp, char **linep, void *usrbuf, size_t maxlen)
+{
+    ssize_t rc, scanned = 0;
+    char *nl;
+
+    if ((rc = rio_fill(rp)) <= 0)
+  return rc;    /* EOF or error */
+    while ((nl = memchr(rp->rio_bufptr + scanned, '\n',
+       rp->rio_cnt - scanned)) == NULL) {
+  scanned = rp->rio_cnt;
+  if ((rc = rio_fillmore(rp)) < 0)
+      return -1;
+  if (rc == 0)
+      break;    /* EOF or buffer full */
+    }
+
+    if (nl == NULL && rp->rio_cnt == rp->rio_size && usrbuf != NULL) {
+  /* too long for the buffer: copy it out */
+  if ((rc = rio_readlineb(rp, usrbuf, maxlen)) <= 0)
+      return rc;
+  *linep = usrbuf;
+  return ((char *)usrbuf)[rc - 1] == '\n' ? rc : rc - 1;
+    }
+
+    rc = nl ? nl - rp->rio_bufptr + 1 : rp->rio_cnt;
+    *linep = rp->rio_bufptr;
+    rp->rio_bufptr += rc;
+    rp->rio_cnt -= rc;
+    return rc;
 }
+/* $end rio_viewlineb */
 
-void Rio_readinitb(rio_t *rp, int fd)
+/*
+ * rio_viewnb - Return the next n bytes in place (buffered)
+ *    Points *datap at the next n bytes inside the internal buffer and
+ *    returns how many there are, fewer only at EOF. They stay valid
+ *    until the next call on rp. If n is larger than the internal
+ *    buffer can grow, they are read into usrbuf as by rio_readnb
+ *    instead, and *datap points there; if usrbuf is NULL, one
+ *    buffer's worth is returned.
+ */
+/* $begin rio_viewnb */
+ssize_t rio_viewnb(rio_t *rp, char **datap, void *usrbuf, size_t n)
 {
-    rio_readinitb(rp, fd);
-} 
+    ssize_t rc;
 
-ssize_t Rio_readnb(rio_t *rp, void *usrbuf, size_t n) 
+    if (n > rp->rio_size && (rp->rio_maxsize == 0 || n > rp->rio_maxsize)) {
+  if (usrbuf != NULL) {
+      if ((rc = rio_readnb(rp, usrbuf, n)) >= 0)
+    *datap = usrbuf;
+      return rc;
+  }
+  n = rp->rio_maxsize ? rp->rio_maxsize : rp->rio_size;
+    }
+    if ((rc = rio_fill(rp)) <= 0)
+  return rc;    /* EOF or error */
+    while (rp->rio_cnt < n) {
+  if ((rc = rio_fillmore(rp)) < 0)
+      return -1;
+  if (rc == 0)
+      break;    /* EOF */
+    }
+
+    if (n > rp->rio_cnt)
+  n = rp->rio_cnt;
+    *datap = rp->rio_bufptr;
+    rp->rio_bufptr += n;
+    rp->rio_cnt -= n;
+    return n;
+}
+/* $end rio_viewnb */
+
+/*
+ * rio_tryreadlineb - Read a text line from a nonblocking fd (buffered)
+ *    Like rio_readlineb, but returns RIO_AGAIN instead of blocking when
+ *    the line is not complete yet. The bytes read so far are kept in
+ *    usrbuf and counted in rp, so call it again with the same usrbuf
+ *    and maxlen once fd is readable, and do not read rp otherwise in
+ *    between. Once the line is complete, returns what rio_readlineb
+ *    returns: the line length if it ends in a newline, one more than
+ *    the number of bytes copied if it was cut short by EOF or maxlen,
+ *    0 on EOF. Returns -1 on error, with errno EINVAL if maxlen < 2.
+ *    usrbuf is NUL-terminated whenever the line is returned.
+ */
+ssize_t rio_tryreadlineb(rio_t *rp, void *usrbuf, size_t maxlen)
 {
+    char *bufp = (char *)usrbuf + rp->rio_partial, *nl = NULL;
+    size_t cnt;
     ssize_t rc;
 
-    if ((rc = rio_readnb(rp, usrbuf, n)) < 0)
-  unix_error("Rio_readnb error");
+    if (maxlen < 2) {
+  errno = EINVAL;
+  return -1;
+    }
+    while (nl == NULL && rp->rio_partial + 1 < maxlen) {
+  if ((rc = rio_fill(rp)) < 0)
+      return errno == EAGAIN || errno == EWOULDBLOCK ? RIO_AGAIN : -1;
+  if (rc == 0)
+      break;    /* EOF */
+  cnt = maxlen - 1 - rp->rio_partial;
+  if (rp->rio_cnt < cnt)
+      cnt = rp->rio_cnt;
+  if ((nl = memchr(rp->rio_bufptr, '\n', cnt)) != NULL)
+      cnt = nl - rp->rio_bufptr + 1;
+  memcpy(bufp, rp->rio_bufptr, cnt);
+  rp->rio_bufptr += cnt;
+  rp->rio_cnt -= cnt;
+  rp->rio_partial += cnt;
+  bufp += cnt;
+    }
+    *bufp = 0;
+    rc = rp->rio_partial;
+    if (nl == NULL && rc > 0)
+  rc++;         /* cut short, as rio_readlineb counts it */
+    rp->rio_partial = 0;
     return rc;
 }
 
-ssize_t Rio_readlineb(rio_t *rp, void *usrbuf, size_t maxlen) 
+/*
+ * rio_tryreadnb - Read n bytes from a nonblocking fd (buffered)
+ *    Like rio_readnb, but returns RIO_AGAIN instead of blocking until
+ *    all n bytes are there; call it again with the same usrbuf and n
+ *    once fd is readable. Returns n (less only at EOF), -1 on error.
+ */
+ssize_t rio_tryreadnb(rio_t *rp, void *usrbuf, size_t n)
 {
+    char *bufp = (char *)usrbuf + rp->rio_partial;
+    size_t cnt;
     ssize_t rc;
 
-    if ((rc = rio_readlineb(rp, usrbuf, maxlen)) < 0)
-  unix_error("Rio_readlineb error");
+    while (rp->rio_partial < n) {
+  if ((rc = rio_fill(rp)) < 0)
+      return errno == EAGAIN || errno == EWOULDBLOCK ? RIO_AGAIN : -1;
+  if (rc == 0)
+      break;    /* EOF */
+  cnt = n - rp->rio_partial;
+  if (rp->rio_cnt < cnt)
+      cnt = rp->rio_cnt;
+  memcpy(bufp, rp->rio_bufptr, cnt);
+  rp->rio_bufptr += cnt;
+  rp->rio_cnt -= cnt;
+  rp->rio_partial += cnt;
+  bufp += cnt;
+    }
+    rc = rp->rio_partial;
+    rp->rio_partial = 0;
     return rc;
-} 
+}
 
-/******************************** 
- * Client/server helper functions
- ********************************/
 /*
- * open_clientfd - open connection to server at <hostname, port> 
- *   and return a socket descriptor ready for reading and writing.
- *   Returns -1 and sets errno on Unix error. 
- *   Returns -2 and sets h_errno on DNS (gethostbyname) error.
+ * rio_writev - robustly write an I/O vector (unbuffered)
+ *    Like rio_writen, resumes after partial writes and EINTR. The
+ *    vector is updated as it is written.
  */
-/* $begin open_clientfd */
-int open_clientfd(char *hostname, int port) 
+static ssize_t rio_writev(int fd, struct iovec *iov, int iovcnt)
 {
-    int clientfd;
-    struct hostent *hp;
-    struct sockaddr_in serveraddr;
-
-    if ((clientfd = socket(AF_INET, SOCK_STREAM, 0)) < 0)
-  return -1; /* check errno for cause of error */
+    ssize_t n = 0, nwritten;
 
-    /* Fill in the server's IP address and port */
-    if ((hp = gethostbyname(hostname)) == NULL)
-  return -2; /* check h_errno for cause of error */
-    bzero((char *) &serveraddr, sizeof(serveraddr));
-    serveraddr.sin_family = AF_INET;
-    bcopy((char *)hp->h_addr_list[0], 
-    (char *)&serveraddr.sin_addr.s_addr, hp->h_length);
-    serveraddr.sin_port = htons(port);
+    while (iovcnt > 0) {
+  if (iov->iov_len == 0) {
+      iov++;
+      iovcnt--;
+      continue;
+  }
+  if ((nwritten = writev(fd, iov, iovcnt)) <= 0) {
+      if (errno == EINTR)  /* interrupted by sig handler return */
+    continue;        /* and call writev() again */
+      else
+    return -1;       /* errno set by writev() */
+  }
+  n += nwritten;
+  while (iovcnt > 0 && nwritten >= iov->iov_len) {
+      nwritten -= iov->iov_len;
+      iov++;
+      iovcnt--;
+  }
+  if (iovcnt > 0) {
+      iov->iov_base = (char *)iov->iov_base + nwritten;
+      iov->iov_len -= nwritten;
+  }
+    }
+    return n;
+}
 
-    /* Establish a connection with the server */
-    if (connect(clientfd, (SA *) &serveraddr, sizeof(serveraddr)) < 0)
-  return -1;
-    return clientfd;
+/*
+ * rio_writeinitb - Associate a descriptor with a write buffer
+ */
+void rio_writeinitb(rio_wt *wp, int fd)
+{
+    wp->rio_fd = fd;
+    wp->rio_cnt = 0;
+    wp->rio_inring = 0;
+}
+
+/*
+ * rio_writenb - Robustly write n bytes (buffered)
+ *    Short writes are copied into the internal buffer, which is
+ *    written when it fills up or by rio_flushb. Writes of RIO_WCOPYMAX
+ *    bytes or more, and writes that do not fit, go out at once together
+ *    with the buffered bytes in a single writev, without copying.
+ *    Returns n, or -1 on error.
+ */
+ssize_t rio_writenb(rio_wt *wp, void *usrbuf, size_t n)
+{
+    struct iovec iov[2];
+
+    if (n < RIO_WCOPYMAX && wp->rio_cnt + n <= sizeof(wp->rio_buf)) {
+  memcpy(wp->rio_buf + wp->rio_cnt, usrbuf, n);
+  wp->rio_cnt += n;
+  if (wp->rio_cnt == sizeof(wp->rio_buf) && rio_flushb(wp) < 0)
+      return -1;
+  return n;
+    }
+
+    iov[0].iov_base = wp->rio_buf;
+    iov[0].iov_len = wp->rio_cnt;
+    iov[1].iov_base = usrbuf;
+    iov[1].iov_len = n;
+    if (rio_writev(wp->rio_fd, iov, 2) < 0)
+  return -1;
+    wp->rio_cnt = 0;
+    return n;
+}
+
+/*
+ * rio_flushb - Write out the buffered bytes. Returns 0, or -1 on error.
+ */
+int rio_flushb(rio_wt *wp)
+{
+    if (wp->rio_cnt > 0 && rio_writen(wp->rio_fd, wp->rio_buf, wp->rio_cnt) < 0)
+  return -1;
+    wp->rio_cnt = 0;
+    return 0;
+}
+
+/*********************************************************************
+ * The io_uring backend for Rio
+ *
+ * A ring lets one thread queue reads into many rio_ts and writes of
+ * many rio_wts and hand them all to the kernel with one system call.
+ * rio_ringread and rio_ringflush queue the operations, rio_ringwait
+ * submits them and collects the results, after which the usual Rio
+ * functions find the data already buffered. A rio_t or rio_wt must
+ * not be used otherwise while it has an operation in the ring.
+ * Where io_uring is unavailable, rio_ringinit fails but leaves a ring
+ * that does each operation at once with read and write instead.
+ **********************************************************************/
+
+#ifdef RIO_URING
+/* rio_enter - io_uring_enter, retried on EINTR */
+static int rio_enter(rio_ring_t *ring, unsigned submit, unsigned wait)
+{
+    int rc;
+
+    ring->nenter++;
+    while ((rc = syscall(__NR_io_uring_enter, ring->fd, submit, wait,
+       wait ? IORING_ENTER_GETEVENTS : 0, NULL, 0)) < 0) {
+  if (errno != EINTR)
+      return -1;
+  submit = *ring->sqtail - __atomic_load_n(ring->sqhead, __ATOMIC_ACQUIRE);
+    }
+    return rc;
+}
+
+/*
+ * rio_reap - Handle every completion in the ring; returns how many.
+ *    Handling a partial write queues the rest, which may reap too, so
+ *    each completion is consumed before it is handled.
+ */
+static int rio_reap(rio_ring_t *ring)
+{
+    unsigned head;
+    unsigned long long data;
+    struct io_uring_cqe *cqe;
+    rio_t *rp;
+    rio_wt *wp;
+    int res, n = 0;
+
+    while ((head = *ring->cqhead) != __atomic_load_n(ring->cqtail, __ATOMIC_ACQUIRE)) {
+  cqe = &ring->cqes[head & *ring->cqmask];
+  data = cqe->user_data;
+  res = cqe->res;
+  __atomic_store_n(ring->cqhead, head + 1, __ATOMIC_RELEASE);
+  ring->inflight--;
+  ring->ndone++;
+  n++;
+
+  if (data & 1) {             /* flush of a rio_wt */
+      wp = (rio_wt *)(uintptr_t)(data & ~1ULL);
+      wp->rio_inring = 0;
+      if (res < 0 && res != -EINTR && res != -EAGAIN) {
+    if (ring->error == 0)
+        ring->error = -res;
+    continue;
+      }
+      if (res > 0) {
+    wp->rio_cnt -= res;
+    memmove(wp->rio_buf, wp->rio_buf + res, wp->rio_cnt);
+      }
+      if (wp->rio_cnt > 0 && rio_ringflush(ring, wp) < 0 && ring->error == 0)
+    ring->error = errno;    /* could not queue the rest */
+  }
+  else {                      /* read into a rio_t */
+      rp = (rio_t *)(uintptr_t)data;
+      rp->rio_inring = 0;
+      rp->rio_ringres = res;
+      if (res > 0)
+    rp->rio_cnt += res;
+  }
+    }
+    return n;
+}
+
+/* rio_queue - Add one operation to the submission queue */
+static int rio_queue(rio_ring_t *ring, int op, int fd, void *addr,
+         unsigned len, int bufindex, unsigned long long data)
+{
+    struct io_uring_sqe *sqe;
+    unsigned tail, index;
+
+    /*
+     * Keep every completion room in the completion queue. Reaping may
+     * queue the rest of a partial write, which moves the tail, so the
+     * tail is read only once there is room.
+     */
+    while (ring->inflight >= ring->cqentries) {
+  if (rio_enter(ring, *ring->sqtail - *ring->sqhead, 1) < 0)
+      return -1;
+  rio_reap(ring);
+    }
+    if (*ring->sqtail - __atomic_load_n(ring->sqhead, __ATOMIC_ACQUIRE) == ring->sqentries &&
+  rio_enter(ring, ring->sqentries, 0) < 0)
+  return -1;
+    tail = *ring->sqtail;
+
+    index = tail & *ring->sqmask;
+    sqe = &ring->sqes[index];
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->opcode = op;
+    sqe->fd = fd;
+    sqe->addr = (uintptr_t)addr;
+    sqe->len = len;
+    sqe->off = -1;              /* use and advance the file position */
+    if (bufindex >= 0)
+  sqe->buf_index = bufindex;
+    sqe->user_data = data;
+    ring->sqarray[index] = index;
+    __atomic_store_n(ring->sqtail, tail + 1, __ATOMIC_RELEASE);
+    ring->inflight++;
+    return 0;
+}
+#endif /* RIO_URING */
+
+/*
+ * rio_ringinit - Set up a ring with room for entries operations.
+ *    Returns -1 and sets errno if io_uring is unavailable, in which
+ *    case the ring still works, doing each operation synchronously.
+ */
+int rio_ringinit(rio_ring_t *ring, unsigned entries)
+{
+#ifdef RIO_URING
+    struct io_uring_params p;
+    char *sq, *cq;
+#endif
+
+    memset(ring, 0, sizeof(*ring));
+    ring->fd = -1;
+#ifdef RIO_URING
+    memset(&p, 0, sizeof(p));
+    if ((ring->fd = syscall(__NR_io_uring_setup, entries, &p)) < 0)
+  return -1;
+    ring->sqentries = p.sq_entries;
+    ring->cqentries = p.cq_entries;
+    ring->sqmaplen = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    ring->cqmaplen = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    if ((p.features & IORING_FEAT_SINGLE_MMAP) && ring->cqmaplen > ring->sqmaplen)
+  ring->sqmaplen = ring->cqmaplen;
+    ring->sqmap = mmap(NULL, ring->sqmaplen, PROT_READ | PROT_WRITE,
+           MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQ_RING);
+    if (ring->sqmap == MAP_FAILED)
+  goto fail;
+    ring->cqmap = ring->sqmap;
+    if (!(p.features & IORING_FEAT_SINGLE_MMAP)) {
+  ring->cqmap = mmap(NULL, ring->cqmaplen, PROT_READ | PROT_WRITE,
+         MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_CQ_RING);
+  if (ring->cqmap == MAP_FAILED)
+      goto fail;
+    }
+    ring->sqeslen = p.sq_entries * sizeof(struct io_uring_sqe);
+    ring->sqes = mmap(NULL, ring->sqeslen, PROT_READ | PROT_WRITE,
+          MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQES);
+    if (ring->sqes == MAP_FAILED)
+  goto fail;
+
+    sq = ring->sqmap;
+    cq = ring->cqmap;
+    ring->sqhead = (unsigned *)(sq + p.sq_off.head);
+    ring->sqtail = (unsigned *)(sq + p.sq_off.tail);
+    ring->sqmask = (unsigned *)(sq + p.sq_off.ring_mask);
+    ring->sqarray = (unsigned *)(sq + p.sq_off.array);
+    ring->cqhead = (unsigned *)(cq + p.cq_off.head);
+    ring->cqtail = (unsigned *)(cq + p.cq_off.tail);
+    ring->cqmask = (unsigned *)(cq + p.cq_off.ring_mask);
+    ring->cqes = (struct io_uring_cqe *)(cq + p.cq_off.cqes);
+    return 0;
+
+ fail:
+    rio_ringfree(ring);
+    return -1;
+#else
+    errno = ENOSYS;
+    return -1;
+#endif
+}
+
+/*
+ * rio_ringfree - Tear down a ring (with no operations in flight)
+ */
+void rio_ringfree(rio_ring_t *ring)
+{
+    int olderrno = errno;
+
+    if (ring->sqes != NULL && ring->sqes != MAP_FAILED)
+  munmap(ring->sqes, ring->sqeslen);
+    if (ring->cqmap != NULL && ring->cqmap != MAP_FAILED && ring->cqmap != ring->sqmap)
+  munmap(ring->cqmap, ring->cqmaplen);
+    if (ring->sqmap != NULL && ring->sqmap != MAP_FAILED)
+  munmap(ring->sqmap, ring->sqmaplen);
+    if (ring->fd >= 0)
+  close(ring->fd);
+    memset(ring, 0, sizeof(*ring));
+    ring->fd = -1;
+    errno = olderrno;
+}
+
+/*
+ * rio_ringregister - Register the buffers of n rio_ts with the ring, so
+ *    the kernel maps them once instead of on every read. Heap buffers
+ *    that may be resized and mapped files are left out, and rio_idleb
+ *    keeps the others. A ring takes one registration.
+ *    Returns 0, or -1 and sets errno.
+ */
+int rio_ringregister(rio_ring_t *ring, rio_t **rps, int n)
+{
+#ifdef RIO_URING
+    struct iovec *iov;
+    int i, k = 0, rc;
+
+    if (ring->fd < 0)
+  return 0;
+    if ((iov = malloc(n * sizeof(struct iovec))) == NULL)
+  return -1;
+    for (i = 0; i < n; i++) {
+  if (rps[i]->rio_maxsize > rps[i]->rio_minsize || rps[i]->rio_map != NULL ||
+      rio_alloc(rps[i]) < 0)
+      continue;
+  iov[k].iov_base = rps[i]->rio_base;
+  iov[k].iov_len = rps[i]->rio_size;
+  rps[i]->rio_bufindex = k++;
+    }
+    if ((rc = syscall(__NR_io_uring_register, ring->fd, IORING_REGISTER_BUFFERS, iov, k)) < 0) {
+  for (i = 0; i < n; i++)
+      rps[i]->rio_bufindex = -1;
+    }
+    free(iov);
+    return rc < 0 ? -1 : 0;
+#else
+    return 0;
+#endif
+}
+
+/*
+ * rio_ringread - Queue a read of more data into the buffer of rp,
+ *    behind its unread bytes. Without a ring, read at once.
+ *    Returns 0, or -1 and sets errno.
+ */
+int rio_ringread(rio_ring_t *ring, rio_t *rp)
+{
+    ssize_t nread;
+    size_t room;
+
+    if (rp->rio_inring)
+  return 0;
+    if (rp->rio_map != NULL) {  /* nothing to wait for */
+  if (rp->rio_cnt == rp->rio_size)
+      return 0;
+  if ((rp->rio_ringres = rio_fillmore(rp)) < 0)
+      rp->rio_ringres = -errno;
+  return rp->rio_ringres < 0 ? -1 : 0;
+    }
+    if (rp->rio_cnt < 0)
+  rp->rio_cnt = 0;
+    if (rio_alloc(rp) < 0) {
+  rp->rio_ringres = -errno;
+  return -1;
+    }
+    rio_resize(rp, rp->rio_size);       /* move unread bytes to the front */
+    if ((room = rp->rio_size - rp->rio_cnt) == 0)
+  return 0;
+
+#ifdef RIO_URING
+    if (ring->fd >= 0) {
+  rp->rio_inring = 1;
+  return rio_queue(ring, rp->rio_bufindex >= 0 ? IORING_OP_READ_FIXED : IORING_OP_READ,
+       rp->rio_fd, rp->rio_base + rp->rio_cnt, room,
+       rp->rio_bufindex, (uintptr_t)rp);
+    }
+#endif
+    while ((nread = read(rp->rio_fd, rp->rio_base + rp->rio_cnt, room)) < 0) {
+  if (errno != EINTR) {
+      rp->rio_ringres = -errno;
+      return -1;
+  }
+    }
+    rp->rio_ringres = nread;
+    rp->rio_cnt += nread;
+    return 0;
+}
+
+/*
+ * rio_ringflush - Queue a write of the buffered bytes of wp; the
+ *    rest of a partial write is queued again when it completes.
+ *    Without a ring, write at once. Returns 0, or -1 and sets errno.
+ */
+int rio_ringflush(rio_ring_t *ring, rio_wt *wp)
+{
+    if (wp->rio_inring || wp->rio_cnt == 0)
+  return 0;
+#ifdef RIO_URING
+    if (ring->fd >= 0) {
+  wp->rio_inring = 1;
+  return rio_queue(ring, IORING_OP_WRITE, wp->rio_fd, wp->rio_buf,
+       wp->rio_cnt, -1, (uintptr_t)wp | 1);
+    }
+#endif
+    return rio_flushb(wp);
+}
+
+/*
+ * rio_ringwait - Submit the queued operations and wait until at least
+ *    minwait of those in flight have completed, handling all that have.
+ *    Returns the number handled, or -1 if a system call or a write
+ *    failed (errno says why; the other results are still handled).
+ */
+int rio_ringwait(rio_ring_t *ring, unsigned minwait)
+{
+#ifdef RIO_URING
+    unsigned submit;
+    unsigned long start = ring->ndone;
+
+    if (ring->fd < 0)
+  return 0;
+    if (minwait > ring->inflight)
+  minwait = ring->inflight;
+    submit = *ring->sqtail - __atomic_load_n(ring->sqhead, __ATOMIC_ACQUIRE);
+    do {
+  if ((submit > 0 || ring->ndone - start < minwait) &&
+      rio_enter(ring, submit, ring->ndone - start < minwait ?
+          minwait - (ring->ndone - start) : 0) < 0)
+      return -1;
+  submit = 0;
+  rio_reap(ring);
+    } while (ring->ndone - start < minwait);
+    if (ring->error) {
+  errno = ring->error;
+  ring->error = 0;
+  return -1;
+    }
+    return ring->ndone - start;
+#else
+    return 0;
+#endif
+}
+
+/**********************************
+ * Wrappers for robust I/O routines
+ **********************************/
+ssize_t Rio_readn(int fd, void *ptr, size_t nbytes) 
+{
+    ssize_t n;
+  
+    if ((n = rio_readn(fd, ptr, nbytes)) < 0)
+  unix_error("Rio_readn error");
+    return n;
+}
+
+void Rio_writen(int fd, void *usrbuf, size_t n) 
+{
+    if (rio_writen(fd, usrbuf, n) != n)
+  unix_error("Rio_writen error");
+}
+
+ssize_t Rio_sendfile(int out_fd, int in_fd, off_t *offset, size_t n)
+{
+    ssize_t rc;
+
+    if ((rc = rio_sendfile(out_fd, in_fd, offset, n)) < 0)
+  unix_error("Rio_sendfile error");
+    return rc;
+}
+
+ssize_t Rio_splice(int out_fd, int in_fd, off_t *offset, size_t n)
+{
+    ssize_t rc;
+
+    if ((rc = rio_splice(out_fd, in_fd, offset, n)) < 0)
+  unix_error("Rio_splice error");
+    return rc;
+}
+
+void Rio_readinitb(rio_t *rp, int fd)
+{
+    rio_readinitb(rp, fd);
+} 
+
+ssize_t Rio_readnb(rio_t *rp, void *usrbuf, size_t n) 
+{
+    ssize_t rc;
+
+    if ((rc = rio_readnb(rp, usrbuf, n)) < 0)
+  unix_error("Rio_readnb error");
+    return rc;
+}
+
+ssize_t Rio_readlineb(rio_t *rp, void *usrbuf, size_t maxlen) 
+{
+    ssize_t rc;
+
+    if ((rc = rio_readlineb(rp, usrbuf, maxlen)) < 0)
+  unix_error("Rio_readlineb error");
+    return rc;
+} 
+
+ssize_t Rio_viewlineb(rio_t *rp, char **linep, void *usrbuf, size_t maxlen)
+{
+    ssize_t rc;
+
+    if ((rc = rio_viewlineb(rp, linep, usrbuf, maxlen)) < 0)
+  unix_error("Rio_viewlineb error");
+    return rc;
+}
+
+ssize_t Rio_viewnb(rio_t *rp, char **datap, void *usrbuf, size_t n)
+{
+    ssize_t rc;
+
+    if ((rc = rio_viewnb(rp, datap, usrbuf, n)) < 0)
+  unix_error("Rio_viewnb error");
+    return rc;
+}
+
+void Rio_readinitheap(rio_t *rp, int fd, size_t minsize, size_t maxsize)
+{
+    if (rio_readinitheap(rp, fd, minsize, maxsize) < 0)
+  unix_error("Rio_readinitheap error");
+}
+
+int Rio_readinitmmap(rio_t *rp, int fd)
+{
+    int rc;
+
+    if ((rc = rio_readinitmmap(rp, fd)) < 0)
+  unix_error("Rio_readinitmmap error");
+    return rc;
+}
+
+ssize_t Rio_tryreadlineb(rio_t *rp, void *usrbuf, size_t maxlen)
+{
+    ssize_t rc;
+
+    if ((rc = rio_tryreadlineb(rp, usrbuf, maxlen)) == -1)
+  unix_error("Rio_tryreadlineb error");
+    return rc;
+}
+
+ssize_t Rio_tryreadnb(rio_t *rp, void *usrbuf, size_t n)
+{
+    ssize_t rc;
+
+    if ((rc = rio_tryreadnb(rp, usrbuf, n)) == -1)
+  unix_error("Rio_tryreadnb error");
+    return rc;
+}
+
+void Rio_writeinitb(rio_wt *wp, int fd)
+{
+    rio_writeinitb(wp, fd);
+}
+
+void Rio_writenb(rio_wt *wp, void *usrbuf, size_t n)
+{
+    if (rio_writenb(wp, usrbuf, n) != n)
+  unix_error("Rio_writenb error");
+}
+
+void Rio_flushb(rio_wt *wp)
+{
+    if (rio_flushb(wp) < 0)
+  unix_error("Rio_flushb error");
+}
+
+void Rio_ringread(rio_ring_t *ring, rio_t *rp)
+{
+    if (rio_ringread(ring, rp) < 0)
+  unix_error("Rio_ringread error");
+}
+
+void Rio_ringflush(rio_ring_t *ring, rio_wt *wp)
+{
+    if (rio_ringflush(ring, wp) < 0)
+  unix_error("Rio_ringflush error");
+}
+
+int Rio_ringwait(rio_ring_t *ring, unsigned minwait)
+{
+    int rc;
+
+    if ((rc = rio_ringwait(ring, minwait)) < 0)
+  unix_error("Rio_ringwait error");
+    return rc;
+}
+
+/*********************************************************************
+ * The resolver cache for open_clientfd
+ *
+ * getaddrinfo answers are kept for resolv_ttl seconds, and failures
+ * for resolv_negttl, in a table of RESOLV_MAXENTRIES names shared by
+ * all threads; the least recently used name makes room for a new one.
+ * A hit on an answer in the last quarter of its life starts a thread
+ * that looks the name up again, so a name in steady use is refreshed
+ * before it expires and never makes a caller wait. Threads that miss
+ * on the same name wait for one lookup instead of each doing their
+ * own. getaddrinfo reports no TTLs, so every name gets the same one.
+ * Names are found through chains hanging off RESOLV_BUCKETS buckets,
+ * picked by the low bits of the hash of the name.
+ **********************************************************************/
+
+#define RESOLV_MAXENTRIES 256  /* names kept at most */
+#define RESOLV_BUCKETS 512     /* hash chains, a power of 2 */
+
+typedef struct resolv_entry {
+    char *name;                /* host name, NULL if the slot is free */
+    unsigned hash;             /* hash of name */
+    int error;                 /* getaddrinfo error, 0 if found */
+    resolv_addrs_t addrs;      /* the addresses if found */
+    time_t expires;            /* when the answer expires, 0 if none yet */
+    unsigned long used;        /* resolv_tick at the last lookup */
+    int busy;                  /* a lookup of name is in progress */
+    struct resolv_entry *next; /* next entry in the bucket of hash */
+} resolv_entry_t;
+
+static resolv_entry_t resolv_cache[RESOLV_MAXENTRIES];
+static resolv_entry_t *resolv_buckets[RESOLV_BUCKETS];
+#define resolv_bucket(hash) (&resolv_buckets[(hash) & (RESOLV_BUCKETS - 1)])
+static pthread_mutex_t resolv_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t resolv_done = PTHREAD_COND_INITIALIZER;
+static unsigned long resolv_tick;  /* counts lookups */
+static int resolv_ttl = 60, resolv_negttl = 5;
+
+static time_t resolv_now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec;
+}
+
+static unsigned resolv_hash(char *name)
+{
+    unsigned h = 2166136261u;   /* FNV-1a */
+
+    while (*name)
+  h = (h ^ (unsigned char)*name++) * 16777619u;
+    return h;
+}
+
+/*
+ * resolv_query - Look hostname up with getaddrinfo, bypassing the
+ *    cache. Returns 0, or the getaddrinfo error.
+ */
+static int resolv_query(char *hostname, resolv_addrs_t *ra)
+{
+    struct addrinfo hints, *listp, *p;
+    int rc;
+
+    memset(&hints, 0, sizeof(struct addrinfo));
+    hints.ai_socktype = SOCK_STREAM;  /* One entry per address */
+    hints.ai_flags = AI_ADDRCONFIG;   /* Recommended for connections */
+    ra->n = 0;
+    if ((rc = getaddrinfo(hostname, NULL, &hints, &listp)) != 0)
+  return rc;
+    for (p = listp; p && ra->n < RESOLV_MAXADDRS; p = p->ai_next) {
+  memcpy(&ra->addr[ra->n], p->ai_addr, p->ai_addrlen);
+  ra->len[ra->n++] = p->ai_addrlen;
+    }
+    freeaddrinfo(listp);
+    return 0;
+}
+
+/* The helpers below are called with resolv_mutex held */
+
+static resolv_entry_t *resolv_find(char *hostname, unsigned hash)
+{
+    resolv_entry_t *e;
+
+    for (e = *resolv_bucket(hash); e != NULL; e = e->next) {
+  if (e->hash == hash && !strcmp(e->name, hostname))
+      return e;
+    }
+    return NULL;
+}
+
+/* resolv_unlink - Take e out of its bucket and free its name */
+static void resolv_unlink(resolv_entry_t *e)
+{
+    resolv_entry_t **pp;
+
+    if (e->name == NULL)
+  return;
+    for (pp = resolv_bucket(e->hash); *pp != e; pp = &(*pp)->next)
+  ;
+    *pp = e->next;
+    free(e->name);
+    e->name = NULL;
+}
+
+/*
+ * resolv_slot - Take a free entry for hostname, or the least recently
+ *    used one that has no lookup in progress. Returns NULL if there
+ *    is none or memory is short.
+ */
+static resolv_entry_t *resolv_slot(char *hostname, unsigned hash)
+{
+    resolv_entry_t *e = NULL;
+    char *name;
+    int i;
+
+    for (i = 0; i < RESOLV_MAXENTRIES; i++) {
+  if (resolv_cache[i].name == NULL) {
+      e = &resolv_cache[i];
+      break;
+  }
+  if (!resolv_cache[i].busy && (e == NULL || resolv_cache[i].used < e->used))
+      e = &resolv_cache[i];
+    }
+    if (e == NULL || (name = strdup(hostname)) == NULL)
+  return NULL;
+    resolv_unlink(e);
+    e->name = name;
+    e->hash = hash;
+    e->expires = 0;
+    e->next = *resolv_bucket(hash);
+    *resolv_bucket(hash) = e;
+    return e;
+}
+
+static void resolv_store(resolv_entry_t *e, int rc, resolv_addrs_t *ra)
+{
+    e->error = rc;
+    e->addrs = *ra;
+    e->expires = resolv_now() + (rc == 0 ? resolv_ttl : resolv_negttl);
+}
+
+/*
+ * resolv_refresh - Thread that looks a cached name up again before it
+ *    expires. A failure leaves the old answer in place until then.
+ */
+static void *resolv_refresh(void *vargp)
+{
+    char *hostname = vargp;
+    resolv_addrs_t ra;
+    resolv_entry_t *e;
+    int rc;
+
+    rc = resolv_query(hostname, &ra);
+    pthread_mutex_lock(&resolv_mutex);
+    if ((e = resolv_find(hostname, resolv_hash(hostname))) != NULL) {
+  if (rc == 0)
+      resolv_store(e, rc, &ra);
+  e->busy = 0;
+    }
+    pthread_cond_broadcast(&resolv_done);
+    pthread_mutex_unlock(&resolv_mutex);
+    free(hostname);
+    return NULL;
+}
+
+/*
+ * resolv_lookup - Find the addresses of hostname, through the cache.
+ *    Thread-safe. Returns 0 and fills in ra, or returns the
+ *    getaddrinfo error (for gai_strerror).
+ */
+int resolv_lookup(char *hostname, resolv_addrs_t *ra)
+{
+    unsigned hash = resolv_hash(hostname);
+    resolv_entry_t *e;
+    pthread_t tid;
+    char *name;
+    time_t now;
+    int rc;
+
+    pthread_mutex_lock(&resolv_mutex);
+    while ((e = resolv_find(hostname, hash)) != NULL) {
+  now = resolv_now();
+  if (e->expires > now) {     /* hit */
+      e->used = ++resolv_tick;
+      rc = e->error;
+      *ra = e->addrs;
+      if (rc == 0 && !e->busy && e->expires - now <= resolv_ttl / 4 &&
+    (name = strdup(hostname)) != NULL) {
+    /* refresh ahead; the thread waits for us to unlock */
+    if (pthread_create(&tid, NULL, resolv_refresh, name) == 0) {
+        pthread_detach(tid);
+        e->busy = 1;
+    }
+    else
+        free(name);
+      }
+      pthread_mutex_unlock(&resolv_mutex);
+      return rc;
+  }
+  if (!e->busy)
+      break;                  /* expired: look it up below */
+  pthread_cond_wait(&resolv_done, &resolv_mutex);
+    }
+    if (e == NULL && (e = resolv_slot(hostname, hash)) == NULL) {
+  pthread_mutex_unlock(&resolv_mutex);
+  return resolv_query(hostname, ra);  /* no room to cache it */
+    }
+    e->used = ++resolv_tick;
+    e->busy = 1;
+    pthread_mutex_unlock(&resolv_mutex);
+
+    rc = resolv_query(hostname, ra);
+
+    pthread_mutex_lock(&resolv_mutex);
+    resolv_store(e, rc, ra);
+    e->busy = 0;
+    pthread_cond_broadcast(&resolv_done);
+    pthread_mutex_unlock(&resolv_mutex);
+    return rc;
+}
+
+/*
+ * resolv_setttl - Set how many seconds later answers are kept, and
+ *    failed lookups; 0 keeps none
+ */
+void resolv_setttl(int ttl, int negttl)
+{
+    pthread_mutex_lock(&resolv_mutex);
+    resolv_ttl = ttl;
+    resolv_negttl = negttl;
+    pthread_mutex_unlock(&resolv_mutex);
+}
+
+/*
+ * resolv_flush - Forget every cached answer, e.g. after /etc/hosts
+ *    has changed. Lookups in progress are still cached when done.
+ */
+void resolv_flush(void)
+{
+    int i;
+
+    pthread_mutex_lock(&resolv_mutex);
+    for (i = 0; i < RESOLV_MAXENTRIES; i++) {
+  if (!resolv_cache[i].busy)
+      resolv_unlink(&resolv_cache[i]);
+    }
+    pthread_mutex_unlock(&resolv_mutex);
+}
+
+/******************************** 
+ * Client/server helper functions
+ ********************************/
+/*
+ * open_clientfd - open connection to server at <hostname, port> 
+ *   and return a socket descriptor ready for reading and writing.
+ *   Tries every address of hostname, IPv6 or IPv4, in the order
+ *   getaddrinfo returns them; the addresses come from the resolver
+ *   cache. Reentrant: threads may connect at once.
+ *   Returns -1 and sets errno on Unix error. 
+ *   Returns -2 on DNS (getaddrinfo) error, after printing it.
+ */
+/* $begin open_clientfd */
+int open_clientfd(char *hostname, int port) 
+{
+    int clientfd = -1, rc, i;
+    resolv_addrs_t ra;
+    struct sockaddr *sa;
+
+    /* Get the server's addresses */
+    if ((rc = resolv_lookup(hostname, &ra)) != 0) {
+  fprintf(stderr, "getaddrinfo failed (%s:%d): %s\n", hostname, port, gai_strerror(rc));
+  return -2;
+    }
+
+    /* Walk the list for one that we can successfully connect to */
+    for (i = 0; i < ra.n; i++) {
+  sa = (SA *)&ra.addr[i];
+  if (sa->sa_family == AF_INET6)
+      ((struct sockaddr_in6 *)sa)->sin6_port = htons(port);
+  else
+      ((struct sockaddr_in *)sa)->sin_port = htons(port);
+
+  /* Create a socket descriptor */
+  if ((clientfd = socket(sa->sa_family, SOCK_STREAM, 0)) < 0)
+      continue; /* Socket failed, try the next */
+
+  /* Connect to the server */
+  if (connect(clientfd, sa, ra.len[i]) != -1)
+      break; /* Success */
+  rc = errno;
+  close(clientfd); /* Connect failed, try another */
+  errno = rc;
+  clientfd = -1;
+    }
+    return clientfd; /* -1 with errno of the last failure if all failed */
+}
+/* $end open_clientfd */
+
+/*  
+ * open_listenfd_opt - open and return a listening socket on port,
+ *     with SO_REUSEPORT set if reuseport is nonzero
+ *     Prefers an IPv6 socket that also accepts IPv4 connections
+ *     (dual stack), and falls back to IPv4 alone where there is no
+ *     IPv6. Reentrant.
+ *     Returns -1 and sets errno on Unix error.
+ *     Returns -2 on DNS (getaddrinfo) error, after printing it.
+ */
+static int open_listenfd_opt(int port, int reuseport) 
+{
+    int listenfd = -1, optval, rc, pass;
+    char service[8];
+    struct addrinfo hints, *listp, *p;
+
+    /* Get a list of potential server addresses */
+    memset(&hints, 0, sizeof(struct addrinfo));
+    hints.ai_socktype = SOCK_STREAM;             /* Accept connections */
+    hints.ai_flags = AI_PASSIVE | AI_ADDRCONFIG; /* ... on any IP address */
+    hints.ai_flags |= AI_NUMERICSERV;            /* ... using port number */
+    sprintf(service, "%d", port);
+    if ((rc = getaddrinfo(NULL, service, &hints, &listp)) != 0) {
+  fprintf(stderr, "getaddrinfo failed (port %d): %s\n", port, gai_strerror(rc));
+  return -2;
+    }
+
+    /* Walk the list for one that we can bind to, IPv6 first */
+    for (pass = 0; pass < 2 && listenfd < 0; pass++) {
+  for (p = listp; p; p = p->ai_next) {
+      if ((p->ai_family == AF_INET6) != (pass == 0))
+    continue;
+      /* Create a socket descriptor */
+      if ((listenfd = socket(p->ai_family, p->ai_socktype, p->ai_protocol)) < 0)
+    continue; /* Socket failed, try the next */
+
+      /* Eliminates "Address already in use" error from bind */
+      optval = 1;
+      setsockopt(listenfd, SOL_SOCKET, SO_REUSEADDR,
+           (const void *)&optval , sizeof(int));
+      /* Take IPv4 connections on an IPv6 socket too */
+      optval = 0;
+      if (p->ai_family == AF_INET6)
+    setsockopt(listenfd, IPPROTO_IPV6, IPV6_V6ONLY,
+         (const void *)&optval , sizeof(int));
+#ifdef __linux__
+      /* Share the port with the other sockets of open_listenfds */
+      optval = 1;
+      if (reuseport && setsockopt(listenfd, SOL_SOCKET, SO_REUSEPORT,
+                (const void *)&optval , sizeof(int)) < 0) {
+    close(listenfd);
+    listenfd = -1;
+    continue;
+      }
+#endif
+
+      /* Bind the descriptor to the address */
+      if (bind(listenfd, p->ai_addr, p->ai_addrlen) == 0)
+    break; /* Success */
+      rc = errno;
+      close(listenfd); /* Bind failed, try the next */
+      errno = rc;
+      listenfd = -1;
+  }
+    }
+
+    /* Clean up */
+    freeaddrinfo(listp);
+    if (listenfd < 0) /* No address worked */
+  return -1;
+
+    /* Make it a listening socket ready to accept connection requests */
+    if (listen(listenfd, LISTENQ) < 0) {
+  rc = errno;
+  close(listenfd);
+  errno = rc;
+  return -1;
+    }
+    return listenfd;
 }
-/* $end open_clientfd */
 
 /*  
  * open_listenfd - open and return a listening socket on port
  *     Returns -1 and sets errno on Unix error.
+ *     Returns -2 on DNS (getaddrinfo) error, after printing it.
+ */
+/* $begin open_listenfd */
+int open_listenfd(int port) 
+{
+    return open_listenfd_opt(port, 0);
+}
+/* $end open_listenfd */
+
+#ifdef __linux__
+/*
+ * open_listenfds - open n listening sockets on port, one for each
+ *     worker thread, that share the port with SO_REUSEPORT. The kernel
+ *     spreads new connections over them, so each worker accepts from
+ *     its own queue without contending for one socket's lock. Workers
+ *     accept with Accept4(fd, ..., SOCK_NONBLOCK | SOCK_CLOEXEC) to get
+ *     descriptors ready for an event loop. If port is 0, all n get the
+ *     port the kernel picks for the first. A connection waiting in the
+ *     queue of a socket that is closed is reset, so close them only
+ *     when shutting down.
+ *     Returns 0 and fills in fds[0..n-1], or returns as open_listenfd
+ *     does, with no socket left open.
+ */
+int open_listenfds(int port, int *fds, int n)
+{
+    struct sockaddr_storage addr;
+    socklen_t len = sizeof(addr);
+    int i, rc = 0, olderrno;
+
+    for (i = 0; i < n; i++) {
+  if ((rc = open_listenfd_opt(port, 1)) < 0)
+      break;
+  fds[i] = rc;
+  rc = 0;
+  if (port == 0) {    /* the others take the port of the first */
+      if ((rc = getsockname(fds[0], (SA *)&addr, &len)) < 0) {
+    i++;
+    break;
+      }
+      if (addr.ss_family == AF_INET6)
+    port = ntohs(((struct sockaddr_in6 *)&addr)->sin6_port);
+      else
+    port = ntohs(((struct sockaddr_in *)&addr)->sin_port);
+  }
+    }
+    if (rc == 0)
+  return 0;
+    olderrno = errno;
+    while (--i >= 0)
+  close(fds[i]);
+    errno = olderrno;
+    return rc;
+}
+#endif
+
+/*********************************************************************
+ * The client connection pool
+ *
+ * conn_checkout hands out a connection to <hostname, port>, reusing
+ * an idle one if there is one, and conn_checkin takes it back, to be
+ * kept for the next request or closed. Idle connections are kept for
+ * conn_idlesecs seconds, the most recently used handed out first, and
+ * each is checked on checkout for having been closed by the server.
+ * No more than conn_maxper connections to one destination are open
+ * at once, idle or not; checkout waits for one to be checked in.
+ * Checkout and checkin close expired idle connections, at most once
+ * a second, and forget destinations with nothing open. Thread-safe.
+ **********************************************************************/
+
+#define CONN_NBUCKETS 64       /* hash buckets of destinations */
+
+typedef struct conn_idle {     /* An idle connection */
+    int fd;
+    time_t since;              /* when it was checked in */
+    struct conn_idle *next;    /* a more recently used one first */
+} conn_idle_t;
+
+typedef struct conn_dest {     /* A destination */
+    char *hostname;
+    int port;
+    int nopen;                 /* connections open, idle or not */
+    int nwait;                 /* threads waiting for one to be freed */
+    conn_idle_t *idle;         /* idle connections */
+    struct conn_dest *next;    /* next in the hash bucket */
+} conn_dest_t;
+
+static conn_dest_t *conn_table[CONN_NBUCKETS];
+static conn_dest_t **conn_owner;   /* fd -> its destination */
+static int conn_nowner;            /* size of conn_owner */
+static pthread_mutex_t conn_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t conn_freed = PTHREAD_COND_INITIALIZER;
+static int conn_maxper = 8, conn_idlesecs = 30;
+static time_t conn_lastsweep;
+
+/* The helpers below are called with conn_mutex held */
+
+/* conn_dest - Find or add the destination <hostname, port> */
+static conn_dest_t *conn_dest(char *hostname, int port)
+{
+    unsigned h = resolv_hash(hostname) ^ port;
+    conn_dest_t *d;
+
+    for (d = conn_table[h % CONN_NBUCKETS]; d; d = d->next) {
+  if (d->port == port && !strcmp(d->hostname, hostname))
+      return d;
+    }
+    if ((d = calloc(1, sizeof(conn_dest_t))) == NULL)
+  return NULL;
+    if ((d->hostname = strdup(hostname)) == NULL) {
+  free(d);
+  return NULL;
+    }
+    d->port = port;
+    d->next = conn_table[h % CONN_NBUCKETS];
+    conn_table[h % CONN_NBUCKETS] = d;
+    return d;
+}
+
+/* conn_setowner - Record that fd is a connection to d (or none) */
+static int conn_setowner(int fd, conn_dest_t *d)
+{
+    conn_dest_t **owner;
+    int n;
+
+    if (fd >= conn_nowner) {
+  n = fd < 64 ? 128 : 2 * fd;
+  if ((owner = realloc(conn_owner, n * sizeof(conn_dest_t *))) == NULL)
+      return -1;
+  memset(owner + conn_nowner, 0, (n - conn_nowner) * sizeof(conn_dest_t *));
+  conn_owner = owner;
+  conn_nowner = n;
+    }
+    conn_owner[fd] = d;
+    return 0;
+}
+
+/* conn_drop - Close connection fd to d */
+static void conn_drop(conn_dest_t *d, int fd)
+{
+    close(fd);
+    conn_owner[fd] = NULL;
+    d->nopen--;
+    pthread_cond_broadcast(&conn_freed);
+}
+
+/*
+ * conn_sweep - Close the connections idle since cutoff or before, and
+ *    free the destinations left with none open and no one waiting
+ */
+static void conn_sweep(time_t cutoff)
+{
+    conn_idle_t **pp, *c;
+    conn_dest_t **dp, *d;
+    int i;
+
+    for (i = 0; i < CONN_NBUCKETS; i++) {
+  for (dp = &conn_table[i]; (d = *dp) != NULL; ) {
+      for (pp = &d->idle; (c = *pp) != NULL; ) {
+    if (c->since > cutoff) {
+        pp = &c->next;
+        continue;
+    }
+    *pp = c->next;
+    conn_drop(d, c->fd);
+    free(c);
+      }
+      if (d->nopen > 0 || d->nwait > 0) {
+    dp = &d->next;
+    continue;
+      }
+      *dp = d->next;
+      free(d->hostname);
+      free(d);
+  }
+    }
+}
+
+/* conn_tick - Sweep out expired idle connections, at most once a second */
+static void conn_tick(void)
+{
+    time_t now;
+
+    if ((now = resolv_now()) != conn_lastsweep) {
+  conn_sweep(now - conn_idlesecs);
+  conn_lastsweep = now;
+    }
+}
+
+/*
+ * conn_alive - Check that an idle connection is still usable: the
+ *    server has neither closed it nor sent anything unasked
+ */
+static int conn_alive(int fd)
+{
+    char c;
+    ssize_t n;
+
+    while ((n = recv(fd, &c, 1, MSG_PEEK | MSG_DONTWAIT)) < 0 && errno == EINTR)
+  ;
+    return n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK);
+}
+
+/*
+ * conn_checkout - Return a connection to <hostname, port>, an idle
+ *    one from the pool if there is a live one, otherwise a new one
+ *    from open_clientfd. Waits while the destination has conn_maxper
+ *    connections open. Returns -1 or -2 as open_clientfd does.
+ */
+int conn_checkout(char *hostname, int port)
+{
+    conn_dest_t *d;
+    conn_idle_t *c;
+    int fd;
+
+    pthread_mutex_lock(&conn_mutex);
+    conn_tick();
+    if ((d = conn_dest(hostname, port)) == NULL) {
+  pthread_mutex_unlock(&conn_mutex);
+  return -1;
+    }
+    for (;;) {
+  if ((c = d->idle) != NULL) {
+      d->idle = c->next;
+      fd = c->fd;
+      free(c);
+      pthread_mutex_unlock(&conn_mutex);
+      if (conn_alive(fd))
+    return fd;
+      pthread_mutex_lock(&conn_mutex);
+      conn_drop(d, fd);   /* closed by the server: try the next */
+      continue;
+  }
+  if (d->nopen < conn_maxper)
+      break;
+  d->nwait++;             /* keeps d from being freed meanwhile */
+  pthread_cond_wait(&conn_freed, &conn_mutex);
+  d->nwait--;
+    }
+    d->nopen++;
+    pthread_mutex_unlock(&conn_mutex);
+
+    fd = open_clientfd(hostname, port);
+
+    pthread_mutex_lock(&conn_mutex);
+    if (fd >= 0 && conn_setowner(fd, d) < 0) {
+  close(fd);
+  errno = ENOMEM;
+  fd = -1;
+    }
+    if (fd < 0) {
+  d->nopen--;
+  pthread_cond_broadcast(&conn_freed);
+    }
+    pthread_mutex_unlock(&conn_mutex);
+    return fd;
+}
+
+/*
+ * conn_checkin - Give back a connection from conn_checkout, to be kept
+ *    for reuse if keep is nonzero, else closed. Only keep connections
+ *    that are between requests, with no response left unread.
+ */
+void conn_checkin(int fd, int keep)
+{
+    conn_dest_t *d;
+    conn_idle_t *c;
+
+    pthread_mutex_lock(&conn_mutex);
+    if (fd < 0 || fd >= conn_nowner || (d = conn_owner[fd]) == NULL)
+  close(fd);              /* not ours */
+    else if (keep && conn_idlesecs > 0 &&
+       (c = malloc(sizeof(conn_idle_t))) != NULL) {
+  c->fd = fd;
+  c->since = resolv_now();
+  c->next = d->idle;
+  d->idle = c;
+  pthread_cond_broadcast(&conn_freed);
+    }
+    else
+  conn_drop(d, fd);
+    conn_tick();
+    pthread_mutex_unlock(&conn_mutex);
+}
+
+/*
+ * conn_setlimits - Set the most connections open to one destination
+ *    and how many seconds idle connections are kept; 0 keeps none
  */
-/* $begin open_listenfd */
-int open_listenfd(int port) 
+void conn_setlimits(int maxper, int idlesecs)
 {
-    int listenfd, optval=1;
-    struct sockaddr_in serveraddr;
-  
-    /* Create a socket descriptor */
-    if ((listenfd = socket(AF_INET, SOCK_STREAM, 0)) < 0)
+    pthread_mutex_lock(&conn_mutex);
+    conn_maxper = maxper > 0 ? maxper : 1;
+    conn_idlesecs = idlesecs;
+    pthread_cond_broadcast(&conn_freed);
+    pthread_mutex_unlock(&conn_mutex);
+}
+
+/* conn_closeidle - Close all idle connections, e.g. before exiting */
+void conn_closeidle(void)
+{
+    pthread_mutex_lock(&conn_mutex);
+    conn_sweep(resolv_now());
+    pthread_mutex_unlock(&conn_mutex);
+}
+
+/*
+ * conn_destroy - Close all idle connections and free everything the
+ *    pool holds. No thread may be in conn_checkout. Connections still
+ *    checked out are no longer the pool's: conn_checkin closes them.
+ */
+void conn_destroy(void)
+{
+    conn_idle_t *c;
+    conn_dest_t *d;
+    int i;
+
+    pthread_mutex_lock(&conn_mutex);
+    for (i = 0; i < CONN_NBUCKETS; i++) {
+  while ((d = conn_table[i]) != NULL) {
+      while ((c = d->idle) != NULL) {
+    d->idle = c->next;
+    close(c->fd);
+    free(c);
+      }
+      conn_table[i] = d->next;
+      free(d->hostname);
+      free(d);
+  }
+    }
+    free(conn_owner);
+    conn_owner = NULL;
+    conn_nowner = 0;
+    pthread_mutex_unlock(&conn_mutex);
+}
+
+#ifdef __linux__
+/*********************************************************************
+ * The event loop
+ *
+ * An epoll-based replacement for select loops. Each thread that
+ * serves descriptors runs its own ev_loop_t: it registers fds with
+ * handlers, level-triggered or with EV_EDGE edge-triggered, sets
+ * timers and calls ev_run, which dispatches until ev_stop. The cost
+ * of a wait depends on the number of ready fds, not on the largest
+ * fd, and there is no FD_SETSIZE limit. All calls on a loop must be
+ * made from its thread (usually from its handlers), except ev_defer
+ * and ev_stop, which other threads use to hand it work and stop it.
+ **********************************************************************/
+
+#define EV_MAXEVENTS 256       /* events taken per epoll_wait */
+
+static long long ev_now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000LL + ts.tv_nsec / 1000000;
+}
+
+/*
+ * ev_init - Create an event loop. Returns 0, or -1 and sets errno.
+ */
+int ev_init(ev_loop_t *loop)
+{
+    struct epoll_event ev;
+
+    memset(loop, 0, sizeof(ev_loop_t));
+    if ((loop->epfd = epoll_create1(EPOLL_CLOEXEC)) < 0)
   return -1;
- 
-    /* Eliminates "Address already in use" error from bind. */
-    if (setsockopt(listenfd, SOL_SOCKET, SO_REUSEADDR, 
-       (const void *)&optval , sizeof(int)) < 0)
+    if ((loop->wakefd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)) < 0) {
+  close(loop->epfd);
+  return -1;
+    }
+    ev.events = EPOLLIN;
+    ev.data.u64 = (uint64_t)-1;
+    if (epoll_ctl(loop->epfd, EPOLL_CTL_ADD, loop->wakefd, &ev) < 0) {
+  ev_free(loop);
+  return -1;
+    }
+    pthread_mutex_init(&loop->lock, NULL);
+    loop->deferredtail = &loop->deferred;
+    loop->nextid = 1;
+    return 0;
+}
+
+/*
+ * ev_free - Free an event loop that is not running. Its registered
+ *    fds are not closed, and pending callbacks are dropped.
+ */
+void ev_free(ev_loop_t *loop)
+{
+    ev_defer_t *d;
+
+    close(loop->epfd);
+    close(loop->wakefd);
+    free(loop->fds);
+    free(loop->timers);
+    while ((d = loop->deferred) != NULL) {
+  loop->deferred = d->next;
+  free(d);
+    }
+    loop->fds = NULL;
+    loop->timers = NULL;
+    loop->nfds = loop->ntimers = loop->maxtimers = 0;
+}
+
+/*
+ * ev_add - Watch fd for events (EV_READ, EV_WRITE, optionally
+ *    EV_EDGE) and call handler(loop, fd, events, arg) when they occur.
+ *    EV_ERROR is always reported. Returns 0, or -1 and sets errno.
+ */
+int ev_add(ev_loop_t *loop, int fd, unsigned events, ev_handler_t handler, void *arg)
+{
+    struct epoll_event ev;
+    ev_fd_t *fds;
+    int n;
+
+    if (fd < 0) {
+  errno = EBADF;
+  return -1;
+    }
+    if (fd >= loop->nfds) {
+  n = fd < 64 ? 128 : 2 * fd;
+  if ((fds = realloc(loop->fds, n * sizeof(ev_fd_t))) == NULL)
+      return -1;
+  memset(fds + loop->nfds, 0, (n - loop->nfds) * sizeof(ev_fd_t));
+  loop->fds = fds;
+  loop->nfds = n;
+    }
+    /* the generation keeps events of an earlier fd with this number away */
+    loop->fds[fd].gen++;
+    ev.events = events;
+    ev.data.u64 = (uint64_t)loop->fds[fd].gen << 32 | (unsigned)fd;
+    if (epoll_ctl(loop->epfd, EPOLL_CTL_ADD, fd, &ev) < 0)
   return -1;
+    loop->fds[fd].handler = handler;
+    loop->fds[fd].arg = arg;
+    return 0;
+}
+
+/*
+ * ev_mod - Change the events watched on a registered fd. Returns 0,
+ *    or -1 and sets errno.
+ */
+int ev_mod(ev_loop_t *loop, int fd, unsigned events)
+{
+    struct epoll_event ev;
 
-    /* Listenfd will be an endpoint for all requests to port
-       on any IP address for this host */
-    bzero((char *) &serveraddr, sizeof(serveraddr));
-    serveraddr.sin_family = AF_INET; 
-    serveraddr.sin_addr.s_addr = htonl(INADDR_ANY); 
-    serveraddr.sin_port = htons((unsigned short)port); 
-    if (bind(listenfd, (SA *)&serveraddr, sizeof(serveraddr)) < 0)
+    if (fd < 0 || fd >= loop->nfds || loop->fds[fd].handler == NULL) {
+  errno = ENOENT;
   return -1;
+    }
+    ev.events = events;
+    ev.data.u64 = (uint64_t)loop->fds[fd].gen << 32 | (unsigned)fd;
+    return epoll_ctl(loop->epfd, EPOLL_CTL_MOD, fd, &ev);
+}
 
-    /* Make it a listening socket ready to accept connection requests */
-    if (listen(listenfd, LISTENQ) < 0)
+/*
+ * ev_del - Stop watching fd; call it before closing fd. Events of fd
+ *    already taken from the kernel are not delivered. Returns 0, or
+ *    -1 and sets errno.
+ */
+int ev_del(ev_loop_t *loop, int fd)
+{
+    if (fd < 0 || fd >= loop->nfds || loop->fds[fd].handler == NULL) {
+  errno = ENOENT;
   return -1;
-    return listenfd;
+    }
+    loop->fds[fd].handler = NULL;
+    return epoll_ctl(loop->epfd, EPOLL_CTL_DEL, fd, NULL);
+}
+
+/* ev_siftdown - Restore the timer heap below slot i */
+static void ev_siftdown(ev_loop_t *loop, int i)
+{
+    ev_timer_t t = loop->timers[i];
+    int child;
+
+    while ((child = 2 * i + 1) < loop->ntimers) {
+  if (child + 1 < loop->ntimers &&
+      loop->timers[child + 1].when < loop->timers[child].when)
+      child++;
+  if (t.when <= loop->timers[child].when)
+      break;
+  loop->timers[i] = loop->timers[child];
+  i = child;
+    }
+    loop->timers[i] = t;
+}
+
+/*
+ * ev_timer - Call cb(loop, arg) once, ms milliseconds from now. A
+ *    timer set by a timer callback waits for the next turn of the
+ *    loop, even with ms 0. Returns an id for ev_cancel, or -1 and
+ *    sets errno.
+ */
+long ev_timer(ev_loop_t *loop, long ms, ev_callback_t cb, void *arg)
+{
+    ev_timer_t *timers, t;
+    int i;
+
+    if (loop->ntimers == loop->maxtimers) {
+  i = loop->maxtimers ? 2 * loop->maxtimers : 16;
+  if ((timers = realloc(loop->timers, i * sizeof(ev_timer_t))) == NULL)
+      return -1;
+  loop->timers = timers;
+  loop->maxtimers = i;
+    }
+    t.when = ev_now() + ms;
+    t.id = loop->nextid++;
+    t.cb = cb;
+    t.arg = arg;
+    for (i = loop->ntimers++; i > 0 && loop->timers[(i - 1) / 2].when > t.when; i = (i - 1) / 2)
+  loop->timers[i] = loop->timers[(i - 1) / 2];
+    loop->timers[i] = t;
+    return t.id;
+}
+
+/*
+ * ev_cancel - Cancel a timer that has not fired. Returns 0, or -1
+ *    if there is no such timer.
+ */
+int ev_cancel(ev_loop_t *loop, long id)
+{
+    int i;
+
+    for (i = 0; i < loop->ntimers; i++) {
+  if (loop->timers[i].id == id && loop->timers[i].cb != NULL) {
+      loop->timers[i].cb = NULL;  /* dropped when it comes up */
+      return 0;
+  }
+    }
+    return -1;
+}
+
+/*
+ * ev_defer - Have the loop call cb(loop, arg) on its next turn, before
+ *    it waits again. Safe to call from any thread; this is how other
+ *    threads hand work to a loop. Returns 0, or -1 and sets errno.
+ */
+int ev_defer(ev_loop_t *loop, ev_callback_t cb, void *arg)
+{
+    ev_defer_t *d;
+    uint64_t one = 1;
+
+    if ((d = malloc(sizeof(ev_defer_t))) == NULL)
+  return -1;
+    d->cb = cb;
+    d->arg = arg;
+    d->next = NULL;
+    pthread_mutex_lock(&loop->lock);
+    *loop->deferredtail = d;
+    loop->deferredtail = &d->next;
+    pthread_mutex_unlock(&loop->lock);
+    if (write(loop->wakefd, &one, sizeof(one)) < 0 && errno != EAGAIN)
+  return -1;
+    return 0;
+}
+
+/*
+ * ev_stop - Make ev_run return after the callback that is running,
+ *    or at once if it is called before ev_run. Safe to call from any
+ *    thread.
+ */
+void ev_stop(ev_loop_t *loop)
+{
+    uint64_t one = 1;
+
+    pthread_mutex_lock(&loop->lock);
+    loop->stopped = 1;
+    pthread_mutex_unlock(&loop->lock);
+    if (write(loop->wakefd, &one, sizeof(one)) < 0)
+  ;   /* the counter is full, so the loop wakes anyway */
+}
+
+/* ev_stopped - Has ev_stop been called? */
+static int ev_stopped(ev_loop_t *loop)
+{
+    int stopped;
+
+    pthread_mutex_lock(&loop->lock);
+    stopped = loop->stopped;
+    pthread_mutex_unlock(&loop->lock);
+    return stopped;
+}
+
+/*
+ * ev_run - Dispatch events, timers and deferred callbacks until
+ *    ev_stop is called. Returns 0, or -1 and sets errno if epoll
+ *    fails. It can be run again after it returns.
+ */
+int ev_run(ev_loop_t *loop)
+{
+    struct epoll_event evs[EV_MAXEVENTS];
+    ev_defer_t *d, *next;
+    ev_timer_t t;
+    ev_fd_t *f;
+    long long now;
+    long firstnew;
+    uint64_t count;
+    int i, n, fd, timeout;
+
+    while (!ev_stopped(loop)) {
+  /* timers that are due, in order; those they set wait a turn */
+  now = ev_now();
+  firstnew = loop->nextid;
+  while (loop->ntimers > 0 && loop->timers[0].when <= now &&
+         loop->timers[0].id < firstnew) {
+      t = loop->timers[0];
+      loop->timers[0] = loop->timers[--loop->ntimers];
+      if (loop->ntimers > 0)
+    ev_siftdown(loop, 0);
+      if (t.cb != NULL)
+    t.cb(loop, t.arg);
+  }
+
+  /* deferred callbacks; those they defer run next turn */
+  pthread_mutex_lock(&loop->lock);
+  d = loop->deferred;
+  loop->deferred = NULL;
+  loop->deferredtail = &loop->deferred;
+  pthread_mutex_unlock(&loop->lock);
+  for (; d != NULL; d = next) {
+      next = d->next;
+      d->cb(loop, d->arg);
+      free(d);
+  }
+
+  /* wait until the next timer at most, not at all if work is queued */
+  timeout = -1;
+  if (loop->ntimers > 0) {
+      now = ev_now();
+      timeout = loop->timers[0].when > now ? loop->timers[0].when - now : 0;
+  }
+  pthread_mutex_lock(&loop->lock);
+  if (loop->deferred != NULL || loop->stopped)
+      timeout = 0;
+  pthread_mutex_unlock(&loop->lock);
+  if ((n = epoll_wait(loop->epfd, evs, EV_MAXEVENTS, timeout)) < 0) {
+      if (errno == EINTR) /* interrupted by sig handler return */
+    continue;
+      return -1;
+  }
+
+  for (i = 0; i < n; i++) {
+      if (evs[i].data.u64 == (uint64_t)-1) {
+    if (read(loop->wakefd, &count, sizeof(count)) < 0)
+        ;   /* already drained */
+    continue;
+      }
+      fd = (int)(evs[i].data.u64 & 0xffffffff);
+      f = &loop->fds[fd];
+      if (f->handler != NULL && f->gen == evs[i].data.u64 >> 32)
+    f->handler(loop, fd, evs[i].events, f->arg);
+  }
+    }
+    pthread_mutex_lock(&loop->lock);
+    loop->stopped = 0;          /* so it can be run again */
+    pthread_mutex_unlock(&loop->lock);
+    return 0;
+}
+
+/*********************************************************************
+ * The thread pool
+ *
+ * Each worker has a Chase-Lev deque of tasks: it pushes and takes
+ * tasks at the bottom, with no lock and, unless the deque is nearly
+ * empty, no atomic read-modify-write, while idle workers steal from
+ * the top of the deques of others, picked at random. Tasks submitted
+ * by a worker go to its own deque, so a task that spawns subtasks
+ * keeps them local and warm until someone idle takes them; tasks
+ * submitted by other threads, and those that do not fit in a full
+ * deque, go to one shared queue under a mutex. Workers that find no
+ * work park on a futex and are woken one at a time as tasks arrive.
+ **********************************************************************/
+
+#define TP_DEQUESIZE 4096      /* tasks per deque, a power of 2 */
+#define TP_SPINS 16            /* rounds of looking before parking */
+
+struct tp_worker {             /* A worker and its deque */
+    long top;                  /* next task to steal */
+    char pad1[56];             /* keep thieves off the owner's line */
+    long bottom;               /* next free slot */
+    char pad2[56];
+    tp_task_t *tasks;          /* TP_DEQUESIZE slots */
+    tp_pool_t *pool;
+    pthread_t tid;
+    unsigned seed;             /* picks the victims to steal from */
+};
+
+static __thread struct tp_worker *tp_self;  /* the worker of this thread */
+
+static void tp_futexwait(int *addr, int val)
+{
+    syscall(SYS_futex, addr, FUTEX_WAIT_PRIVATE, val, NULL, NULL, 0);
+}
+
+static void tp_futexwake(int *addr, int n)
+{
+    syscall(SYS_futex, addr, FUTEX_WAKE_PRIVATE, n, NULL, NULL, 0);
 }
-/* $end open_listenfd */
+
+/* tp_push - Owner: push a task at the bottom; -1 if the deque is full */
+static int tp_push(struct tp_worker *w, tp_func_t func, void *arg)
+{
+    long b = __atomic_load_n(&w->bottom, __ATOMIC_RELAXED);
+    long t = __atomic_load_n(&w->top, __ATOMIC_ACQUIRE);
+    tp_task_t *slot = &w->tasks[b & (TP_DEQUESIZE - 1)];
+
+    if (b - t >= TP_DEQUESIZE)
+  return -1;
+    __atomic_store_n(&slot->func, func, __ATOMIC_RELAXED);
+    __atomic_store_n(&slot->arg, arg, __ATOMIC_RELAXED);
+    __atomic_store_n(&w->bottom, b + 1, __ATOMIC_RELEASE);
+    return 0;
+}
+
+/* tp_take - Owner: take the task at the bottom; 0 if there is none */
+static int tp_take(struct tp_worker *w, tp_task_t *task)
+{
+    long b = __atomic_load_n(&w->bottom, __ATOMIC_RELAXED) - 1;
+    long t;
+    int found = 1;
+
+    __atomic_store_n(&w->bottom, b, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    t = __atomic_load_n(&w->top, __ATOMIC_RELAXED);
+    if (t > b) {                /* empty */
+  __atomic_store_n(&w->bottom, b + 1, __ATOMIC_RELAXED);
+  return 0;
+    }
+    task->func = w->tasks[b & (TP_DEQUESIZE - 1)].func;
+    task->arg = w->tasks[b & (TP_DEQUESIZE - 1)].arg;
+    if (t == b) {               /* the last one: race the thieves for it */
+  found = __atomic_compare_exchange_n(&w->top, &t, t + 1, 0,
+              __ATOMIC_SEQ_CST, __ATOMIC_RELAXED);
+  __atomic_store_n(&w->bottom, b + 1, __ATOMIC_RELAXED);
+    }
+    return found;
+}
+
+/* tp_steal - Thief: take the task at the top; 0 if none or we lost */
+static int tp_steal(struct tp_worker *w, tp_task_t *task)
+{
+    long t = __atomic_load_n(&w->top, __ATOMIC_ACQUIRE);
+    long b;
+    tp_task_t *slot;
+
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    b = __atomic_load_n(&w->bottom, __ATOMIC_ACQUIRE);
+    if (t >= b)
+  return 0;
+    slot = &w->tasks[t & (TP_DEQUESIZE - 1)];
+    task->func = __atomic_load_n(&slot->func, __ATOMIC_RELAXED);
+    task->arg = __atomic_load_n(&slot->arg, __ATOMIC_RELAXED);
+    return __atomic_compare_exchange_n(&w->top, &t, t + 1, 0,
+               __ATOMIC_SEQ_CST, __ATOMIC_RELAXED);
+}
+
+/* tp_dequeue - Take a task from the shared queue; 0 if it is empty */
+static int tp_dequeue(tp_pool_t *pool, tp_task_t *task)
+{
+    int found = 0;
+
+    if (__atomic_load_n(&pool->nqueued, __ATOMIC_SEQ_CST) == 0)
+  return 0;
+    pthread_mutex_lock(&pool->lock);
+    if (pool->qcount > 0) {
+  *task = pool->queue[pool->qhead];
+  pool->qhead = (pool->qhead + 1) % pool->qsize;
+  pool->qcount--;
+  __atomic_store_n(&pool->nqueued, pool->qcount, __ATOMIC_SEQ_CST);
+  found = 1;
+    }
+    pthread_mutex_unlock(&pool->lock);
+    return found;
+}
+
+/* tp_enqueue - Add a task to the shared queue; -1 if out of memory */
+static int tp_enqueue(tp_pool_t *pool, tp_func_t func, void *arg)
+{
+    tp_task_t *queue;
+    long i, size;
+
+    pthread_mutex_lock(&pool->lock);
+    if (pool->qcount == pool->qsize) {  /* double it, unwrapping */
+  size = pool->qsize ? 2 * pool->qsize : 1024;
+  if ((queue = malloc(size * sizeof(tp_task_t))) == NULL) {
+      pthread_mutex_unlock(&pool->lock);
+      return -1;
+  }
+  for (i = 0; i < pool->qcount; i++)
+      queue[i] = pool->queue[(pool->qhead + i) % pool->qsize];
+  free(pool->queue);
+  pool->queue = queue;
+  pool->qhead = 0;
+  pool->qsize = size;
+    }
+    pool->queue[(pool->qhead + pool->qcount) % pool->qsize].func = func;
+    pool->queue[(pool->qhead + pool->qcount) % pool->qsize].arg = arg;
+    pool->qcount++;
+    __atomic_store_n(&pool->nqueued, pool->qcount, __ATOMIC_SEQ_CST);
+    pthread_mutex_unlock(&pool->lock);
+    return 0;
+}
+
+/*
+ * tp_find - Find a task for w: from its own deque, then the shared
+ *    queue, then the deques of the others, starting at a random one
+ */
+static int tp_find(struct tp_worker *w, tp_task_t *task)
+{
+    tp_pool_t *pool = w->pool;
+    int i, n = pool->nworkers, start;
+
+    if (tp_take(w, task) || tp_dequeue(pool, task))
+  return 1;
+    w->seed = w->seed * 1103515245 + 12345;
+    start = (w->seed >> 16) % n;
+    for (i = 0; i < n; i++) {
+  if (&pool->workers[(start + i) % n] != w &&
+      tp_steal(&pool->workers[(start + i) % n], task))
+      return 1;
+    }
+    return 0;
+}
+
+/* tp_done - Count a task finished, waking tp_wait if it was the last */
+static void tp_done(tp_pool_t *pool)
+{
+    if (__atomic_sub_fetch(&pool->pending, 1, __ATOMIC_SEQ_CST) == 0 &&
+  __atomic_load_n(&pool->nwaiters, __ATOMIC_SEQ_CST) > 0)
+  tp_futexwake(&pool->pending, INT_MAX);
+}
+
+/* tp_worker - Body of a worker thread */
+static void *tp_worker(void *vargp)
+{
+    struct tp_worker *w = vargp;
+    tp_pool_t *pool = w->pool;
+    tp_task_t task;
+    int i, seq, found;
+
+    tp_self = w;
+    for (;;) {
+  for (i = 0, found = 0; i < TP_SPINS && !found; i++) {
+      if (!(found = tp_find(w, &task)))
+    sched_yield();
+  }
+  if (!found) {
+      /* count ourselves idle before the last look, so that a
+         submitter either sees us idle or we see its task */
+      __atomic_add_fetch(&pool->nidle, 1, __ATOMIC_SEQ_CST);
+      seq = __atomic_load_n(&pool->wakeseq, __ATOMIC_SEQ_CST);
+      if (!(found = tp_find(w, &task))) {
+    if (__atomic_load_n(&pool->stopping, __ATOMIC_SEQ_CST)) {
+        __atomic_sub_fetch(&pool->nidle, 1, __ATOMIC_SEQ_CST);
+        return NULL;
+    }
+    tp_futexwait(&pool->wakeseq, seq);
+      }
+      __atomic_sub_fetch(&pool->nidle, 1, __ATOMIC_SEQ_CST);
+  }
+  if (found) {
+      task.func(task.arg);
+      tp_done(pool);
+  }
+    }
+}
+
+/* tp_stop - Stop the first nthreads workers and free the pool */
+static void tp_stop(tp_pool_t *pool, int nthreads)
+{
+    int i;
+
+    __atomic_store_n(&pool->stopping, 1, __ATOMIC_SEQ_CST);
+    __atomic_add_fetch(&pool->wakeseq, 1, __ATOMIC_SEQ_CST);
+    tp_futexwake(&pool->wakeseq, INT_MAX);
+    for (i = 0; i < nthreads; i++)
+  pthread_join(pool->workers[i].tid, NULL);
+    for (i = 0; i < pool->nworkers; i++)
+  free(pool->workers[i].tasks);
+    free(pool->workers);
+    free(pool->queue);
+    pthread_mutex_destroy(&pool->lock);
+    pool->workers = NULL;
+    pool->queue = NULL;
+    pool->nworkers = 0;
+}
+
+/*
+ * tp_init - Start a pool of nworkers threads. Returns 0, or -1 and
+ *    sets errno.
+ */
+int tp_init(tp_pool_t *pool, int nworkers)
+{
+    int i, rc;
+
+    memset(pool, 0, sizeof(tp_pool_t));
+    if (nworkers < 1) {
+  errno = EINVAL;
+  return -1;
+    }
+    if ((pool->workers = calloc(nworkers, sizeof(struct tp_worker))) == NULL)
+  return -1;
+    pthread_mutex_init(&pool->lock, NULL);
+    pool->nworkers = nworkers;
+    for (i = 0; i < nworkers; i++) {
+  pool->workers[i].pool = pool;
+  pool->workers[i].seed = i + 1;
+  if ((pool->workers[i].tasks = malloc(TP_DEQUESIZE * sizeof(tp_task_t))) == NULL) {
+      tp_stop(pool, 0);
+      errno = ENOMEM;
+      return -1;
+  }
+    }
+    for (i = 0; i < nworkers; i++) {
+  if ((rc = pthread_create(&pool->workers[i].tid, NULL, tp_worker,
+         &pool->workers[i])) != 0) {
+      tp_stop(pool, i);
+      errno = rc;
+      return -1;
+  }
+    }
+    return 0;
+}
+
+/* tp_free - Wait for the tasks that are left, then stop the pool */
+void tp_free(tp_pool_t *pool)
+{
+    tp_wait(pool);
+    tp_stop(pool, pool->nworkers);
+}
+
+/*
+ * tp_submit - Have the pool call func(arg). A task submitted from a
+ *    worker goes to that worker's deque, any other to the shared
+ *    queue. Returns 0, or -1 and sets errno if out of memory.
+ */
+int tp_submit(tp_pool_t *pool, tp_func_t func, void *arg)
+{
+    __atomic_add_fetch(&pool->pending, 1, __ATOMIC_SEQ_CST);
+    if ((tp_self == NULL || tp_self->pool != pool ||
+   tp_push(tp_self, func, arg) < 0) &&
+  tp_enqueue(pool, func, arg) < 0) {
+  tp_done(pool);
+  errno = ENOMEM;
+  return -1;
+    }
+
+    /* pairs with the idle count in tp_worker: wake one if any parked */
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&pool->nidle, __ATOMIC_SEQ_CST) > 0) {
+  __atomic_add_fetch(&pool->wakeseq, 1, __ATOMIC_SEQ_CST);
+  tp_futexwake(&pool->wakeseq, 1);
+    }
+    return 0;
+}
+
+/*
+ * tp_wait - Wait until every task submitted so far, and every task
+ *    they submitted, has finished. Not to be called from a task.
+ */
+void tp_wait(tp_pool_t *pool)
+{
+    int n;
+
+    __atomic_add_fetch(&pool->nwaiters, 1, __ATOMIC_SEQ_CST);
+    while ((n = __atomic_load_n(&pool->pending, __ATOMIC_SEQ_CST)) != 0)
+  tp_futexwait(&pool->pending, n);
+    __atomic_sub_fetch(&pool->nwaiters, 1, __ATOMIC_SEQ_CST);
+}
+#endif
 
 /******************************************
  * Wrappers for the client/server helper routines 
@@ -797,7 +3338,7 @@ int Open_clientfd(char *hostname, int port)
       if (rc == -1)
           unix_error("Open_clientfd Unix error");
       else        
-          dns_error("Open_clientfd DNS error");
+          app_error("Open_clientfd DNS error");
     }
     return rc;
 }
@@ -806,12 +3347,105 @@ int Open_listenfd(int port)
 {
     int rc;
 
-    if ((rc = open_listenfd(port)) < 0)
-      unix_error("Open_listenfd error");
+    if ((rc = open_listenfd(port)) < 0) {
+      if (rc == -1)
+          unix_error("Open_listenfd error");
+      else
+          app_error("Open_listenfd DNS error");
+    }
+    return rc;
+}
+
+#ifdef __linux__
+int Open_listenfds(int port, int *fds, int n) 
+{
+    int rc;
+
+    if ((rc = open_listenfds(port, fds, n)) < 0) {
+      if (rc == -1)
+          unix_error("Open_listenfds error");
+      else
+          app_error("Open_listenfds DNS error");
+    }
     return rc;
 }
-/* $end csapp.c */
+#endif
+
+int Conn_checkout(char *hostname, int port) 
+{
+    int rc;
+
+    if ((rc = conn_checkout(hostname, port)) < 0) {
+      if (rc == -1)
+          unix_error("Conn_checkout Unix error");
+      else        
+          app_error("Conn_checkout DNS error");
+    }
+    return rc;
+}
+
+/******************************************
+ * Wrappers for the event loop
+ ******************************************/
+#ifdef __linux__
+void Ev_init(ev_loop_t *loop)
+{
+    if (ev_init(loop) < 0)
+  unix_error("Ev_init error");
+}
+
+void Ev_add(ev_loop_t *loop, int fd, unsigned events, ev_handler_t handler, void *arg)
+{
+    if (ev_add(loop, fd, events, handler, arg) < 0)
+  unix_error("Ev_add error");
+}
+
+void Ev_mod(ev_loop_t *loop, int fd, unsigned events)
+{
+    if (ev_mod(loop, fd, events) < 0)
+  unix_error("Ev_mod error");
+}
+
+void Ev_del(ev_loop_t *loop, int fd)
+{
+    if (ev_del(loop, fd) < 0)
+  unix_error("Ev_del error");
+}
+
+long Ev_timer(ev_loop_t *loop, long ms, ev_callback_t cb, void *arg)
+{
+    long id;
+
+    if ((id = ev_timer(loop, ms, cb, arg)) < 0)
+  unix_error("Ev_timer error");
+    return id;
+}
 
+void Ev_defer(ev_loop_t *loop, ev_callback_t cb, void *arg)
+{
+    if (ev_defer(loop, cb, arg) < 0)
+  unix_error("Ev_defer error");
+}
 
+void Ev_run(ev_loop_t *loop)
+{
+    if (ev_run(loop) < 0)
+  unix_error("Ev_run error");
+}
 
+/******************************************
+ * Wrappers for the thread pool
+ ******************************************/
+void Tp_init(tp_pool_t *pool, int nworkers)
+{
+    if (tp_init(pool, nworkers) < 0)
+  unix_error("Tp_init error");
+}
 
+void Tp_submit(tp_pool_t *pool, tp_func_t func, void *arg)
+{
+    if (tp_submit(pool, func, arg) < 0)
+  unix_error("Tp_submit error");
+}
+#endif
+/* $end csapp.c */
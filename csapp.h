@@ -15,6 +15,7 @@
 #include <sys/stat.h>
 #include <fcntl.h>
 #include <sys/mman.h>
+#include <sys/uio.h>
 #include <errno.h>
 #include <math.h>
 #include <pthread.h>
@@ -43,10 +44,131 @@ typedef struct {
     int rio_fd;                /* descriptor for this internal buf */
     int rio_cnt;               /* unread bytes in internal buf */
     char *rio_bufptr;          /* next unread byte in internal buf */
-    char rio_buf[RIO_BUFSIZE]; /* internal buffer */
+    char *rio_base;            /* internal buf: rio_buf, the caller's or a heap
+                                  buf, NULL while a heap buf is idle */
+    size_t rio_size;           /* size of internal buf */
+    size_t rio_minsize;        /* heap buf: smallest size it shrinks to */
+    size_t rio_maxsize;        /* heap buf: largest size, 0 if not heap */
+    int rio_nfull;             /* reads in a row that filled the buf */
+    int rio_nshort;            /* reads in a row that used little of it */
+    size_t rio_partial;        /* bytes of a pending try-read already copied */
+    int rio_bufindex;          /* index of the buf in its ring, -1 if none */
+    int rio_inring;            /* a ring read into the buf is in flight */
+    int rio_ringres;           /* last ring read: bytes, 0 on EOF, -errno */
+    char *rio_map;             /* mapped window of the file, NULL if none */
+    size_t rio_maplen;         /* length of the mapped window */
+    off_t rio_mapoff;          /* file offset of the mapped window */
+    off_t rio_mapend;          /* file size when last looked at */
+    char rio_buf[RIO_BUFSIZE]; /* default internal buffer */
 } rio_t;
 /* $end rio_t */
 
+/* Returned by the try-read functions when a nonblocking fd has no data */
+#define RIO_AGAIN -2
+
+/* Persistent state for the buffered Rio writer */
+#define RIO_WCOPYMAX 1024      /* longer writes are not copied */
+typedef struct {
+    int rio_fd;                /* descriptor for this internal buf */
+    int rio_cnt;               /* buffered bytes not yet written */
+    int rio_inring;            /* a ring write of the buf is in flight */
+    char rio_buf[RIO_BUFSIZE]; /* internal buffer */
+} rio_wt;
+
+/* An io_uring shared by many rio_ts and rio_wts, usually one per thread */
+typedef struct {
+    int fd;                    /* ring descriptor, -1 to use plain syscalls */
+    unsigned sqentries;        /* size of the submission queue */
+    unsigned cqentries;        /* size of the completion queue */
+    unsigned inflight;         /* operations submitted or queued, not done */
+    unsigned *sqhead, *sqtail, *sqmask, *sqarray;
+    unsigned *cqhead, *cqtail, *cqmask;
+    struct io_uring_sqe *sqes; /* submission queue entries */
+    struct io_uring_cqe *cqes; /* completion queue entries */
+    void *sqmap, *cqmap;       /* the mapped rings */
+    size_t sqmaplen, cqmaplen, sqeslen;
+    int error;                 /* first errno seen by rio_ringwait */
+    unsigned long nenter;      /* io_uring_enter calls so far */
+    unsigned long ndone;       /* operations completed so far */
+} rio_ring_t;
+
+/* The addresses of a host name, as kept by the resolver cache */
+#define RESOLV_MAXADDRS 8      /* addresses kept per name */
+typedef struct {
+    int n;                     /* number of addresses */
+    struct sockaddr_storage addr[RESOLV_MAXADDRS]; /* ports are 0 */
+    socklen_t len[RESOLV_MAXADDRS];
+} resolv_addrs_t;
+
+#ifdef __linux__
+#include <sys/epoll.h>
+
+/* Events an event loop watches for and reports */
+#define EV_READ  EPOLLIN       /* fd is readable */
+#define EV_WRITE EPOLLOUT      /* fd is writable */
+#define EV_EDGE  EPOLLET       /* report only changes (edge-triggered) */
+#define EV_ERROR (EPOLLERR | EPOLLHUP) /* always reported */
+
+struct ev_loop;
+typedef void (*ev_handler_t)(struct ev_loop *loop, int fd, unsigned events, void *arg);
+typedef void (*ev_callback_t)(struct ev_loop *loop, void *arg);
+
+typedef struct {               /* A registered fd */
+    ev_handler_t handler;      /* NULL if fd is not registered */
+    void *arg;
+    unsigned gen;              /* registrations of fd so far */
+} ev_fd_t;
+
+typedef struct {               /* A pending timer */
+    long long when;            /* expiry time in ms */
+    long id;
+    ev_callback_t cb;          /* NULL once cancelled */
+    void *arg;
+} ev_timer_t;
+
+typedef struct ev_defer {      /* A deferred callback */
+    ev_callback_t cb;
+    void *arg;
+    struct ev_defer *next;
+} ev_defer_t;
+
+/* An epoll event loop, run by one thread */
+typedef struct ev_loop {
+    int epfd;                  /* epoll descriptor */
+    int wakefd;                /* eventfd that wakes the loop */
+    ev_fd_t *fds;              /* registrations, indexed by fd */
+    int nfds;                  /* size of fds */
+    ev_timer_t *timers;        /* heap of timers, earliest first */
+    int ntimers, maxtimers;
+    long nextid;               /* id of the next timer */
+    pthread_mutex_t lock;      /* protects deferred and stopped */
+    ev_defer_t *deferred, **deferredtail; /* callbacks to run next */
+    int stopped;               /* ev_stop was called */
+} ev_loop_t;
+
+typedef void (*tp_func_t)(void *arg);
+
+typedef struct {               /* A task of a thread pool */
+    tp_func_t func;
+    void *arg;
+} tp_task_t;
+
+/* A work-stealing thread pool */
+typedef struct {
+    int nworkers;
+    struct tp_worker *workers; /* one deque and thread each */
+    pthread_mutex_t lock;      /* protects the queue of submitted tasks */
+    tp_task_t *queue;          /* tasks submitted from other threads */
+    long qhead, qcount, qsize;
+    int nqueued;               /* qcount, readable without the lock */
+    int nidle;                 /* workers looking for work to park */
+    int wakeseq;               /* futex that idle workers park on */
+    int pending;               /* tasks submitted, not yet finished */
+    int nwaiters;              /* threads in tp_wait */
+    int stopping;              /* tp_free was called */
+} tp_pool_t;
+#endif
+
 /* External variables */
 extern int h_errno;    /* defined by BIND for DNS errors */ 
 extern char **environ; /* defined by libc */
@@ -60,6 +182,7 @@ extern char **environ; /* defined by libc */
 void unix_error(char *msg);
 void posix_error(int code, char *msg);
 void dns_error(char *msg);
+void eai_error(int code, char *msg);
 void app_error(char *msg);
 
 /* Process control wrappers */
@@ -91,7 +214,7 @@ ssize_t Write(int fd, const void *buf, size_t count);
 off_t Lseek(int fildes, off_t offset, int whence);
 void Close(int fd);
 int Select(int  n, fd_set *readfds, fd_set *writefds, fd_set *exceptfds, 
-     struct timeval *timeout);
+     struct timeval *timeout);  /* see also the event loop below */
 int Dup2(int fd1, int fd2);
 void Stat(const char *filename, struct stat *buf);
 void Fstat(int fd, struct stat *buf) ;
@@ -121,9 +244,17 @@ void Setsockopt(int s, int level, int optname, const void *optval, int optlen);
 void Bind(int sockfd, struct sockaddr *my_addr, int addrlen);
 void Listen(int s, int backlog);
 int Accept(int s, struct sockaddr *addr, socklen_t *addrlen);
+#ifdef __linux__
+int Accept4(int s, struct sockaddr *addr, socklen_t *addrlen, int flags);
+#endif
 void Connect(int sockfd, struct sockaddr *serv_addr, int addrlen);
 
 /* DNS wrappers */
+void Getaddrinfo(const char *node, const char *service,
+                 const struct addrinfo *hints, struct addrinfo **res);
+void Getnameinfo(const struct sockaddr *sa, socklen_t salen, char *host,
+                 size_t hostlen, char *serv, size_t servlen, int flags);
+void Freeaddrinfo(struct addrinfo *res);
 struct hostent *Gethostbyname(const char *name);
 struct hostent *Gethostbyaddr(const char *addr, int len, int type);
 
@@ -145,24 +276,108 @@ void V(sem_t *sem);
 /* Rio (Robust I/O) package */
 ssize_t rio_readn(int fd, void *usrbuf, size_t n);
 ssize_t rio_writen(int fd, void *usrbuf, size_t n);
+ssize_t rio_sendfile(int out_fd, int in_fd, off_t *offset, size_t n);
+ssize_t rio_splice(int out_fd, int in_fd, off_t *offset, size_t n);
 void rio_readinitb(rio_t *rp, int fd); 
 ssize_t rio_readnb(rio_t *rp, void *usrbuf, size_t n);
 ssize_t rio_readlineb(rio_t *rp, void *usrbuf, size_t maxlen);
+ssize_t rio_viewlineb(rio_t *rp, char **linep, void *usrbuf, size_t maxlen);
+ssize_t rio_viewnb(rio_t *rp, char **datap, void *usrbuf, size_t n);
+void rio_readinitbuf(rio_t *rp, int fd, void *buf, size_t size);
+int rio_readinitheap(rio_t *rp, int fd, size_t minsize, size_t maxsize);
+int rio_readinitmmap(rio_t *rp, int fd);
+void rio_idleb(rio_t *rp);
+void rio_freeb(rio_t *rp);
+ssize_t rio_tryreadlineb(rio_t *rp, void *usrbuf, size_t maxlen);
+ssize_t rio_tryreadnb(rio_t *rp, void *usrbuf, size_t n);
+void rio_writeinitb(rio_wt *wp, int fd);
+ssize_t rio_writenb(rio_wt *wp, void *usrbuf, size_t n);
+int rio_flushb(rio_wt *wp);
+int rio_ringinit(rio_ring_t *ring, unsigned entries);
+void rio_ringfree(rio_ring_t *ring);
+int rio_ringregister(rio_ring_t *ring, rio_t **rps, int n);
+int rio_ringread(rio_ring_t *ring, rio_t *rp);
+int rio_ringflush(rio_ring_t *ring, rio_wt *wp);
+int rio_ringwait(rio_ring_t *ring, unsigned minwait);
 
 /* Wrappers for Rio package */
 ssize_t Rio_readn(int fd, void *usrbuf, size_t n);
 void Rio_writen(int fd, void *usrbuf, size_t n);
+ssize_t Rio_sendfile(int out_fd, int in_fd, off_t *offset, size_t n);
+ssize_t Rio_splice(int out_fd, int in_fd, off_t *offset, size_t n);
 void Rio_readinitb(rio_t *rp, int fd); 
 ssize_t Rio_readnb(rio_t *rp, void *usrbuf, size_t n);
 ssize_t Rio_readlineb(rio_t *rp, void *usrbuf, size_t maxlen);
+ssize_t Rio_viewlineb(rio_t *rp, char **linep, void *usrbuf, size_t maxlen);
+ssize_t Rio_viewnb(rio_t *rp, char **datap, void *usrbuf, size_t n);
+void Rio_readinitheap(rio_t *rp, int fd, size_t minsize, size_t maxsize);
+int Rio_readinitmmap(rio_t *rp, int fd);
+ssize_t Rio_tryreadlineb(rio_t *rp, void *usrbuf, size_t maxlen);
+ssize_t Rio_tryreadnb(rio_t *rp, void *usrbuf, size_t n);
+void Rio_writeinitb(rio_wt *wp, int fd);
+void Rio_writenb(rio_wt *wp, void *usrbuf, size_t n);
+void Rio_flushb(rio_wt *wp);
+void Rio_ringread(rio_ring_t *ring, rio_t *rp);
+void Rio_ringflush(rio_ring_t *ring, rio_wt *wp);
+int Rio_ringwait(rio_ring_t *ring, unsigned minwait);
 
 /* Client/server helper functions */
+int resolv_lookup(char *hostname, resolv_addrs_t *ra);
+void resolv_setttl(int ttl, int negttl);
+void resolv_flush(void);
 int open_clientfd(char *hostname, int portno);
 int open_listenfd(int portno);
+#ifdef __linux__
+int open_listenfds(int portno, int *fds, int n);
+#endif
+int conn_checkout(char *hostname, int port);
+void conn_checkin(int fd, int keep);
+void conn_setlimits(int maxper, int idlesecs);
+void conn_closeidle(void);
+void conn_destroy(void);
+
+#ifdef __linux__
+/* Event loop */
+int ev_init(ev_loop_t *loop);
+void ev_free(ev_loop_t *loop);
+int ev_add(ev_loop_t *loop, int fd, unsigned events, ev_handler_t handler, void *arg);
+int ev_mod(ev_loop_t *loop, int fd, unsigned events);
+int ev_del(ev_loop_t *loop, int fd);
+long ev_timer(ev_loop_t *loop, long ms, ev_callback_t cb, void *arg);
+int ev_cancel(ev_loop_t *loop, long id);
+int ev_defer(ev_loop_t *loop, ev_callback_t cb, void *arg);
+int ev_run(ev_loop_t *loop);
+void ev_stop(ev_loop_t *loop);
+
+/* Thread pool */
+int tp_init(tp_pool_t *pool, int nworkers);
+void tp_free(tp_pool_t *pool);
+int tp_submit(tp_pool_t *pool, tp_func_t func, void *arg);
+void tp_wait(tp_pool_t *pool);
+#endif
 
 /* Wrappers for client/server helper functions */
 int Open_clientfd(char *hostname, int port);
 int Open_listenfd(int port); 
+#ifdef __linux__
+int Open_listenfds(int port, int *fds, int n);
+#endif
+int Conn_checkout(char *hostname, int port);
+
+#ifdef __linux__
+/* Event loop wrappers */
+void Ev_init(ev_loop_t *loop);
+void Ev_add(ev_loop_t *loop, int fd, unsigned events, ev_handler_t handler, void *arg);
+void Ev_mod(ev_loop_t *loop, int fd, unsigned events);
+void Ev_del(ev_loop_t *loop, int fd);
+long Ev_timer(ev_loop_t *loop, long ms, ev_callback_t cb, void *arg);
+void Ev_defer(ev_loop_t *loop, ev_callback_t cb, void *arg);
+void Ev_run(ev_loop_t *loop);
+
+/* Thread pool wrappers */
+void Tp_init(tp_pool_t *pool, int nworkers);
+void Tp_submit(tp_pool_t *pool, tp_func_t func, void *arg);
+#endif
 
 #endif /* __CSAPP_H__ */
 /* $end csapp.h */
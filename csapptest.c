@@ -0,0 +1,558 @@
+/*
+ * csapptest.c - Regression tests for the additions to csapp.c
+ *
+ * usage: csapptest [-h] [<test> ...]
+ * Runs the named tests, or all of them, and prints one line for each.
+ * A failed check prints what went wrong and exits with status 1; a
+ * test that hangs is stopped by an alarm after TIMEOUT seconds.
+ *     ring     partial ring writes requeued while the queues are full
+ *     splice   rio_splice into a nonblocking socket, reusing its pipe
+ *     resolv   resolver cache hits, expiry and refresh ahead
+ *     pool     connection pool reuse, dead peers and idle expiry
+ *     ev       event loop timers, ev_defer and deletes in dispatch
+ */
+#define _GNU_SOURCE         /* for F_SETPIPE_SZ */
+#include "csapp.h"
+
+#define TIMEOUT 30          /* seconds before a hung test fails */
+
+/* check - Fail the current test unless cond holds */
+#define check(cond, what) \
+    do { if (!(cond)) fail(__LINE__, what); } while (0)
+
+char *current = "";         /* name of the running test */
+void (*cleanup)(void);      /* undoes what the running test changed */
+
+void fail(int line, char *what)
+{
+    printf("%s: line %d: %s\n", current, line, what);
+    if (cleanup != NULL)
+        cleanup();
+    exit(1);
+}
+
+void timeout_handler(int sig)
+{
+    printf("%s: timed out\n", current);
+    fflush(stdout);
+    if (cleanup != NULL)
+        cleanup();
+    _exit(1);
+}
+
+/*
+ * ringtest - Queue more writes into little pipes than the completion
+ *    queue of a small ring holds. Each write is cut short by its pipe,
+ *    so the rest is queued again while rio_queue is still making room
+ *    for the next write. Every byte must arrive, in order, and every
+ *    operation must complete.
+ */
+#define RINGPIPES 32        /* pipes, one rio_wt each */
+#define RINGCHUNK 1000      /* bytes per rio_writenb */
+#define RINGCHUNKS 8        /* rio_writenb calls per rio_wt */
+
+void ringtest(void)
+{
+    rio_ring_t ring;
+    rio_wt w[RINGPIPES];
+    int fds[RINGPIPES][2], i, j, k, live;
+    char chunk[RINGCHUNK], buf[RINGCHUNK];
+    long got[RINGPIPES];
+    ssize_t n;
+    pid_t pid;
+
+    if (rio_ringinit(&ring, 2) < 0) {
+        printf("%-8s skipped (no io_uring)\n", current);
+        return;
+    }
+    for (i = 0; i < RINGPIPES; i++) {
+        if (pipe(fds[i]) < 0)
+            unix_error("pipe error");
+        fcntl(fds[i][1], F_SETPIPE_SZ, 4096);
+        fcntl(fds[i][1], F_SETFL, O_NONBLOCK);
+    }
+
+    /* the child drains the pipes slowly and checks what arrives */
+    fflush(stdout);
+    if ((pid = Fork()) == 0) {
+        for (i = 0; i < RINGPIPES; i++) {
+            Close(fds[i][1]);
+            fcntl(fds[i][0], F_SETFL, O_NONBLOCK);
+            got[i] = 0;
+        }
+        for (live = RINGPIPES; live > 0; ) {
+            for (i = 0; i < RINGPIPES; i++) {
+                if (got[i] < 0)
+                    continue;
+                if ((n = read(fds[i][0], buf, 512)) < 0) {
+                    check(errno == EAGAIN, "read error");
+                    continue;
+                }
+                if (n == 0) {
+                    check(got[i] == RINGCHUNK * RINGCHUNKS, "short stream");
+                    got[i] = -1;
+                    live--;
+                    continue;
+                }
+                for (k = 0; k < n; k++)
+                    check(buf[k] == (char)('a' + (got[i] + k) % RINGCHUNK % 26),
+                          "bytes out of order");
+                got[i] += n;
+            }
+            usleep(100);
+        }
+        exit(0);
+    }
+    for (i = 0; i < RINGPIPES; i++)
+        Close(fds[i][0]);
+
+    for (k = 0; k < RINGCHUNK; k++)
+        chunk[k] = 'a' + k % 26;
+    for (i = 0; i < RINGPIPES; i++) {
+        Rio_writeinitb(&w[i], fds[i][1]);
+        for (j = 0; j < RINGCHUNKS; j++)
+            Rio_writenb(&w[i], chunk, RINGCHUNK);
+        Rio_ringflush(&ring, &w[i]);
+    }
+    while (ring.inflight > 0)
+        Rio_ringwait(&ring, 1);
+    for (i = 0; i < RINGPIPES; i++) {
+        check(w[i].rio_cnt == 0 && !w[i].rio_inring, "write left over");
+        Close(fds[i][1]);
+    }
+    rio_ringfree(&ring);
+    Waitpid(pid, &i, 0);
+    check(WIFEXITED(i) && WEXITSTATUS(i) == 0, "reader failed");
+    printf("%-8s ok\n", current);
+}
+
+/*
+ * splicetest - Splice a file into a nonblocking socket that a slow
+ *    reader empties, twice. Each call must move the whole file, in
+ *    order, though the socket is often full, and the second call must
+ *    reuse the pipe of the first rather than open another.
+ */
+#define SPLICESIZE (1 << 20)    /* bytes of the file */
+
+void splicetest(void)
+{
+    char name[] = "/tmp/csapptest.XXXXXX", buf[4096];
+    int fd, sv[2], i, k, before, after;
+    long got;
+    ssize_t n;
+    pid_t pid;
+
+    if ((fd = mkstemp(name)) < 0)
+        unix_error("mkstemp error");
+    unlink(name);
+    for (k = 0; k < sizeof(buf); k++)
+        buf[k] = 'a' + k % 26;
+    for (i = 0; i < SPLICESIZE / sizeof(buf); i++)
+        Rio_writen(fd, buf, sizeof(buf));
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, sv) < 0)
+        unix_error("socketpair error");
+    k = 4096;
+    setsockopt(sv[0], SOL_SOCKET, SO_SNDBUF, &k, sizeof(k));
+    fcntl(sv[0], F_SETFL, O_NONBLOCK);
+
+    fflush(stdout);
+    if ((pid = Fork()) == 0) {
+        Close(sv[0]);
+        for (got = 0; (n = Read(sv[1], buf, 1000)) > 0; got += n) {
+            for (k = 0; k < n; k++)
+                check(buf[k] == (char)('a' + (got + k) % sizeof(buf) % 26),
+                      "bytes out of order");
+            if (got % 64 == 0)
+                usleep(10);
+        }
+        check(got == 2L * SPLICESIZE, "short stream");
+        exit(0);
+    }
+    Close(sv[1]);
+
+    for (i = 0; i < 2; i++) {
+        before = dup(0);
+        close(before);
+        check(lseek(fd, 0, SEEK_SET) == 0, "lseek error");
+        check(rio_splice(sv[0], fd, NULL, SPLICESIZE) == SPLICESIZE, "short splice");
+        after = dup(0);
+        close(after);
+        check(i == 0 || after == before, "pipe not reused");
+    }
+    Close(sv[0]);
+    Close(fd);
+    Waitpid(pid, &i, 0);
+    check(WIFEXITED(i) && WEXITSTATUS(i) == 0, "reader failed");
+    printf("%-8s ok\n", current);
+}
+
+/*
+ * resolvtest - Look a name up through the resolver cache while its
+ *    address in /etc/hosts changes underneath. A hit must keep the old
+ *    address, an expired answer must be looked up again, and a hit in
+ *    the last quarter of an answer's life must start a refresh that
+ *    the next hit sees before the answer expires. Skipped unless
+ *    /etc/hosts is writable; the line it adds is removed after.
+ */
+#define RESOLVNAME "csapptest.invalid"
+
+int hostsfd = -1;           /* /etc/hosts, while resolvtest changes it */
+off_t hostssize;            /* its size before */
+
+void hostsrestore(void)
+{
+    if (hostsfd >= 0 && ftruncate(hostsfd, hostssize) < 0)
+        printf("could not restore /etc/hosts\n");
+}
+
+/* sethost - Point RESOLVNAME at 127.0.0.<host>, a single digit */
+void sethost(int host)
+{
+    char line[64];
+    int n;
+
+    n = sprintf(line, "\n127.0.0.%d " RESOLVNAME "\n", host);
+    check(pwrite(hostsfd, line, n, hostssize) == n, "pwrite error");
+}
+
+/* resolved - Return the x of the address 127.0.0.x of RESOLVNAME */
+int resolved(void)
+{
+    resolv_addrs_t ra;
+    struct sockaddr_in *sa;
+
+    check(resolv_lookup(RESOLVNAME, &ra) == 0 && ra.n > 0, "lookup failed");
+    sa = (struct sockaddr_in *)&ra.addr[0];
+    check(sa->sin_family == AF_INET, "not an IPv4 address");
+    return ntohl(sa->sin_addr.s_addr) & 0xff;
+}
+
+void resolvtest(void)
+{
+    struct timespec half = {0, 500000000};
+    struct stat st;
+
+    if ((hostsfd = open("/etc/hosts", O_RDWR)) < 0) {
+        printf("%-8s skipped (/etc/hosts is read-only)\n", current);
+        return;
+    }
+    Fstat(hostsfd, &st);
+    hostssize = st.st_size;
+    cleanup = hostsrestore;
+
+    resolv_flush();
+    resolv_setttl(2, 1);
+    sethost(1);
+    check(resolved() == 1, "wrong address");
+    sethost(2);
+    check(resolved() == 1, "hit not served from the cache");
+    sleep(3);
+    check(resolved() == 2, "expired answer served");
+
+    /*
+     * An answer stored in second s expires at s + 8, and a hit from
+     * s + 6 on refreshes it. 6.5 seconds later is in that window
+     * whatever the fraction of s; 7 seconds later is still before the
+     * expiry, save for a few milliseconds where it expires anyway.
+     */
+    resolv_setttl(8, 1);
+    resolv_flush();
+    check(resolved() == 2, "flushed answer served");
+    sethost(3);
+    sleep(6);
+    nanosleep(&half, NULL);
+    check(resolved() == 2, "answer refreshed too early");
+    nanosleep(&half, NULL);
+    check(resolved() == 3, "answer not refreshed ahead");
+
+    hostsrestore();
+    Close(hostsfd);
+    hostsfd = -1;
+    cleanup = NULL;
+    resolv_setttl(60, 5);
+    resolv_flush();
+    printf("%-8s ok\n", current);
+}
+
+/*
+ * pooltest - Check connections to a listening socket of our own out
+ *    of the connection pool and back in. A connection checked in must
+ *    be handed out again, one the server has closed must be replaced,
+ *    and an idle one must be closed by a later checkin once it has
+ *    expired. conn_destroy must leave no descriptor open.
+ */
+
+/* closed - Tell whether the peer of the server side fd has closed */
+int closed(int fd)
+{
+    char c;
+
+    return recv(fd, &c, 1, MSG_DONTWAIT) == 0;
+}
+
+void pooltest(void)
+{
+    struct sockaddr_storage addr;
+    socklen_t len = sizeof(addr);
+    int listenfd, port, before, after, fd1, fd2, fd3, s1, s2, s3;
+
+    before = dup(0);
+    close(before);
+    if ((listenfd = open_listenfd(0)) < 0)
+        unix_error("open_listenfd error");
+    if (getsockname(listenfd, (SA *)&addr, &len) < 0)
+        unix_error("getsockname error");
+    if (addr.ss_family == AF_INET6)
+        port = ntohs(((struct sockaddr_in6 *)&addr)->sin6_port);
+    else
+        port = ntohs(((struct sockaddr_in *)&addr)->sin_port);
+    fcntl(listenfd, F_SETFL, O_NONBLOCK);
+    conn_setlimits(4, 1);
+
+    /* reuse */
+    check((fd1 = conn_checkout("localhost", port)) >= 0, "checkout failed");
+    check((s1 = accept(listenfd, NULL, NULL)) >= 0, "no connection made");
+    conn_checkin(fd1, 1);
+    check(conn_checkout("localhost", port) == fd1, "idle connection not reused");
+    check(accept(listenfd, NULL, NULL) < 0 && errno == EAGAIN, "connection made anew");
+
+    /* a connection the server has closed is replaced */
+    conn_checkin(fd1, 1);
+    Close(s1);
+    check((fd2 = conn_checkout("localhost", port)) >= 0, "checkout failed");
+    check((s2 = accept(listenfd, NULL, NULL)) >= 0, "closed connection reused");
+
+    /* an expired idle connection is closed by the next checkin */
+    check((fd3 = conn_checkout("localhost", port)) >= 0, "checkout failed");
+    check((s3 = accept(listenfd, NULL, NULL)) >= 0, "no connection made");
+    conn_checkin(fd2, 1);
+    sleep(2);
+    check(!closed(s2), "idle connection closed without a sweep");
+    conn_checkin(fd3, 0);
+    check(closed(s2), "expired connection kept");
+    check(closed(s3), "connection not closed on checkin");
+
+    /* teardown */
+    check((fd1 = conn_checkout("localhost", port)) >= 0, "checkout failed");
+    conn_checkin(fd1, 1);
+    conn_destroy();
+    Close(s2);
+    Close(s3);
+    Close(Accept(listenfd, NULL, NULL));
+    Close(listenfd);
+    after = dup(0);
+    close(after);
+    check(after == before, "descriptor left open");
+    conn_setlimits(8, 30);
+    printf("%-8s ok\n", current);
+}
+
+/*
+ * evtest - Run an event loop four times. Timers must fire in the
+ *    order they expire, whatever order they were set in, and not at
+ *    all once cancelled. A timer that sets itself again for 0 ms
+ *    must let the loop turn in between. Callbacks deferred from
+ *    another thread must wake a loop with nothing else to do and run
+ *    on its thread, in the order they were deferred. An fd deleted by
+ *    a handler must not get the event already taken for it, nor must
+ *    a new fd given its number before the next wait. A negative fd
+ *    must be refused.
+ */
+#define EVLOG 8
+
+int evlog[EVLOG], nevlog;   /* args of the callbacks, in call order */
+pthread_t evtid;            /* the thread running the loop */
+int evpipes[2][2];          /* pipes whose read ends the handlers swap */
+int evnhandled, evmarked;
+
+void evrecord(ev_loop_t *loop, void *arg)
+{
+    check(nevlog < EVLOG, "too many callbacks");
+    check(pthread_equal(pthread_self(), evtid), "callback on another thread");
+    evlog[nevlog++] = (long)arg;
+}
+
+void evstop(ev_loop_t *loop, void *arg)
+{
+    evrecord(loop, arg);
+    ev_stop(loop);
+}
+
+void evdeferred(ev_loop_t *loop, void *arg)
+{
+    evrecord(loop, arg);
+    Ev_defer(loop, evrecord, (void *)2L);
+    Ev_defer(loop, evstop, (void *)3L);
+}
+
+void *evdefer(void *vargp)
+{
+    usleep(50000);
+    Ev_defer(vargp, evdeferred, (void *)1L);
+    return NULL;
+}
+
+void evmark(ev_loop_t *loop, void *arg)
+{
+    evmarked = 1;
+}
+
+/* evrearm - Timer that sets itself again for 0 ms, 100 times */
+void evrearm(ev_loop_t *loop, void *arg)
+{
+    check(evmarked, "rearmed timer ran again in the same turn");
+    evmarked = 0;
+    Ev_defer(loop, evmark, NULL);
+    if (++nevlog < 100)
+        Ev_timer(loop, 0, evrearm, NULL);
+    else
+        ev_stop(loop);
+}
+
+/* evnew - Handler of the fd that took the number of a deleted one */
+void evnew(ev_loop_t *loop, int fd, unsigned events, void *arg)
+{
+    char c;
+
+    check(evmarked, "stale event delivered to a new registration");
+    Read(fd, &c, 1);
+    Ev_del(loop, fd);
+    ev_stop(loop);
+}
+
+/*
+ * evdel - Handler of both pipes: deletes and closes both, then puts a
+ *    new readable pipe under the number of the other
+ */
+void evdel(ev_loop_t *loop, int fd, unsigned events, void *arg)
+{
+    int other = fd == evpipes[0][0] ? evpipes[1][0] : evpipes[0][0];
+    int fds[2];
+
+    evnhandled++;
+    Ev_del(loop, fd);
+    Ev_del(loop, other);
+    Close(fd);
+    evpipes[1 - (long)arg][0] = -1;
+    if (pipe(fds) < 0)
+        unix_error("pipe error");
+    Dup2(fds[0], other);
+    Close(fds[0]);
+    Close(evpipes[(long)arg][1]);
+    evpipes[(long)arg][1] = fds[1];
+    Rio_writen(fds[1], "x", 1);
+    Ev_add(loop, other, EV_READ, evnew, NULL);
+    Ev_defer(loop, evmark, NULL);   /* runs before the next wait */
+}
+
+void evtest(void)
+{
+    ev_loop_t loop;
+    pthread_t tid;
+    int i;
+
+    Ev_init(&loop);
+    evtid = pthread_self();
+
+    /* timer order */
+    Ev_timer(&loop, 30, evrecord, (void *)3L);
+    Ev_timer(&loop, 10, evrecord, (void *)1L);
+    check(ev_cancel(&loop, Ev_timer(&loop, 5, evrecord, (void *)9L)) == 0,
+          "cancel failed");
+    Ev_timer(&loop, 40, evstop, (void *)4L);
+    Ev_timer(&loop, 20, evrecord, (void *)2L);
+    Ev_run(&loop);
+    check(nevlog == 4, "wrong number of timers fired");
+    for (i = 0; i < nevlog; i++)
+        check(evlog[i] == i + 1, "timers out of order");
+    check(ev_add(&loop, -1, EV_READ, evdel, NULL) < 0 && errno == EBADF,
+          "negative fd added");
+
+    /* a timer set again from its own callback */
+    nevlog = 0;
+    evmarked = 1;
+    Ev_timer(&loop, 0, evrearm, NULL);
+    Ev_run(&loop);
+    check(nevlog == 100, "rearmed timer stopped early");
+
+    /* ev_defer from another thread */
+    nevlog = 0;
+    Pthread_create(&tid, NULL, evdefer, &loop);
+    Ev_run(&loop);
+    Pthread_join(tid, NULL);
+    check(nevlog == 3, "wrong number of deferred callbacks");
+    for (i = 0; i < nevlog; i++)
+        check(evlog[i] == i + 1, "deferred callbacks out of order");
+
+    /* deletes during dispatch */
+    evmarked = 0;
+    for (i = 0; i < 2; i++) {
+        if (pipe(evpipes[i]) < 0)
+            unix_error("pipe error");
+        Rio_writen(evpipes[i][1], "x", 1);
+    }
+    Ev_add(&loop, evpipes[0][0], EV_READ, evdel, (void *)1L);
+    Ev_add(&loop, evpipes[1][0], EV_READ, evdel, (void *)0L);
+    Ev_run(&loop);
+    check(evnhandled == 1, "event delivered to a deleted fd");
+    ev_free(&loop);
+    for (i = 0; i < 2; i++) {
+        if (evpipes[i][0] >= 0)
+            Close(evpipes[i][0]);
+        Close(evpipes[i][1]);
+    }
+    printf("%-8s ok\n", current);
+}
+
+struct {
+    char *name;
+    void (*run)(void);
+} tests[] = {
+    {"ring", ringtest},
+    {"splice", splicetest},
+    {"resolv", resolvtest},
+    {"pool", pooltest},
+    {"ev", evtest},
+};
+#define NTESTS (sizeof(tests) / sizeof(tests[0]))
+
+void usage(char *prog)
+{
+    int i;
+
+    printf("Usage: %s [-h] [<test> ...]\n", prog);
+    printf("   -h      print this message\n");
+    printf("   <test>  run only these tests:");
+    for (i = 0; i < NTESTS; i++)
+        printf(" %s", tests[i].name);
+    printf("\n");
+    exit(1);
+}
+
+int main(int argc, char **argv)
+{
+    int c, i, j;
+
+    while ((c = getopt(argc, argv, "h")) != EOF)
+        usage(argv[0]);
+    for (j = optind; j < argc; j++) {
+        for (i = 0; i < NTESTS && strcmp(argv[j], tests[i].name); i++)
+            ;
+        if (i == NTESTS)
+            usage(argv[0]);
+    }
+
+    Signal(SIGPIPE, SIG_IGN);
+    Signal(SIGALRM, timeout_handler);
+    for (i = 0; i < NTESTS; i++) {
+        for (j = optind; j < argc && strcmp(argv[j], tests[i].name); j++)
+            ;
+        if (optind < argc && j == argc)
+            continue;
+        current = tests[i].name;
+        alarm(TIMEOUT);
+        tests[i].run();
+    }
+    alarm(0);
+    exit(0);
+}
@@ -0,0 +1,230 @@
+/*
+ * jobbench.c - Microbenchmarks for the tsh job list
+ *
+ * usage: jobbench [-s <seed>]
+ * Builds the job list code of tsh.c into this program with MAXJOBS
+ * set at compile time (make jobbench builds one binary per size),
+ * fills the list completely and times addjob, deletejob, getjobpid,
+ * getjobjid, pid2jid, fgpid and listbgjobs on it. Each operation is
+ * run with sequential PIDs, as a shell usually sees them, and with
+ * PIDs drawn uniformly from the whole PID range.
+ *
+ * Every line reports ns/op and, where perf_event allows it, cache
+ * misses/op, so alternative job list designs can be compared by
+ * swapping the code in tsh.c and rerunning.
+ */
+#define main tsh_main
+#include "tsh.c"
+#undef main
+
+#define PIDRANGE   4194304  /* default pid_max on 64-bit Linux */
+#define TARGETOPS 20000000  /* job-slot visits per measurement */
+
+pid_t *pids;                /* PID of each job currently in the list */
+int cachefd = -1;           /* cache-miss counter, -1 if unavailable */
+
+/* openmisses - Count cache misses of this process, -1 if not permitted */
+int openmisses(void)
+{
+    struct perf_event_attr attr;
+
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = PERF_TYPE_HARDWARE;
+    attr.config = PERF_COUNT_HW_CACHE_MISSES;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    return syscall(SYS_perf_event_open, &attr, 0, -1, -1, PERF_FLAG_FD_CLOEXEC);
+}
+
+/* readmisses - Return the current cache-miss count, 0 if unavailable */
+unsigned long long readmisses(void)
+{
+    unsigned long long count = 0;
+
+    if (cachefd >= 0 && read(cachefd, &count, sizeof(count)) != sizeof(count)) {
+        count = 0;
+    }
+    return count;
+}
+
+/* genpids - Make n distinct PIDs, either increasing or spread at random */
+void genpids(pid_t *out, int n, int random)
+{
+    static unsigned char *used;
+    int i;
+    pid_t pid;
+
+    if (!random) {
+        for (i = 0; i < n; i++) {
+            out[i] = 1000 + i;
+        }
+        return;
+    }
+    if (used == NULL && (used = calloc(PIDRANGE, 1)) == NULL) {
+        unix_error("calloc failed");
+    }
+    memset(used, 0, PIDRANGE);
+    for (i = 0; i < n; i++) {
+        do {
+            pid = 2 + rand() % (PIDRANGE - 2);
+        } while (used[pid]);
+        used[pid] = 1;
+        out[i] = pid;
+    }
+}
+
+/* report - Print one measurement line */
+void report(char *dist, char *op, long long ns, unsigned long long misses, int nops)
+{
+    printf("%-7d %-10s %-12s %12.1f", MAXJOBS, dist, op, (double)ns / nops);
+    if (cachefd >= 0) {
+        printf(" %14.2f\n", (double)misses / nops);
+    } else {
+        printf(" %14s\n", "n/a");
+    }
+}
+
+/*
+ * benchdist - Run every operation on a full job list whose PIDs follow
+ *    one distribution.
+ */
+void benchdist(char *dist, int random, int nops)
+{
+    int i, k, t, devnull, stdoutfd;
+    int *idx = malloc(nops * sizeof(int));
+    pid_t *newpids = malloc(nops * sizeof(pid_t));
+    volatile long long sink = 0;
+    long long start;
+    unsigned long long misses;
+
+    if (idx == NULL || newpids == NULL) {
+        unix_error("malloc failed");
+    }
+
+    /* fill the whole list */
+    initjobs(jobs);
+    nextjid = 1;
+    genpids(pids, MAXJOBS, random);
+    for (i = 0; i < MAXJOBS; i++) {
+        addjob(jobs, pids[i], BG, "bench\n");
+    }
+    for (k = 0; k < nops; k++) {
+        idx[k] = rand() % MAXJOBS;
+    }
+
+    /* lookups of jobs that are in the list */
+    start = nowns();
+    misses = readmisses();
+    for (k = 0; k < nops; k++) {
+        sink += (long)getjobpid(jobs, pids[idx[k]]);
+    }
+    report(dist, "getjobpid", nowns() - start, readmisses() - misses, nops);
+
+    start = nowns();
+    misses = readmisses();
+    for (k = 0; k < nops; k++) {
+        sink += (long)getjobjid(jobs, idx[k] + 1);
+    }
+    report(dist, "getjobjid", nowns() - start, readmisses() - misses, nops);
+
+    start = nowns();
+    misses = readmisses();
+    for (k = 0; k < nops; k++) {
+        sink += pid2jid(pids[idx[k]]);
+    }
+    report(dist, "pid2jid", nowns() - start, readmisses() - misses, nops);
+
+    /* fgpid with the foreground job at a random position */
+    getjobpid(jobs, pids[idx[0]])->state = FG;
+    start = nowns();
+    misses = readmisses();
+    for (k = 0; k < nops; k++) {
+        sink += fgpid(jobs);
+    }
+    report(dist, "fgpid", nowns() - start, readmisses() - misses, nops);
+    getjobpid(jobs, pids[idx[0]])->state = BG;
+
+    /* listbgjobs prints the whole list; send it to /dev/null */
+    fflush(stdout);
+    stdoutfd = dup(1);
+    if ((devnull = open("/dev/null", O_WRONLY)) < 0) {
+        unix_error("open /dev/null failed");
+    }
+    dup2(devnull, 1);
+    start = nowns();
+    misses = readmisses();
+    for (k = 0; k < nops / MAXJOBS + 1; k++) {
+        listbgjobs(jobs);
+    }
+    fflush(stdout);
+    dup2(stdoutfd, 1);
+    close(devnull);
+    close(stdoutfd);
+    report(dist, "listbgjobs", nowns() - start, readmisses() - misses, nops / MAXJOBS + 1);
+
+    /* replace jobs: delete existing PIDs, then add fresh ones */
+    if (nops > MAXJOBS) {
+        nops = MAXJOBS;
+    }
+    genpids(newpids, nops, random);
+    for (k = 0; k < nops; k++) {
+        idx[k] = k;
+    }
+    for (k = nops - 1; k > 0; k--) {    /* random order, no repeats */
+        i = rand() % (k + 1);
+        t = idx[k];
+        idx[k] = idx[i];
+        idx[i] = t;
+    }
+
+    start = nowns();
+    misses = readmisses();
+    for (k = 0; k < nops; k++) {
+        sink += deletejob(jobs, pids[idx[k]]);
+    }
+    report(dist, "deletejob", nowns() - start, readmisses() - misses, nops);
+
+    start = nowns();
+    misses = readmisses();
+    for (k = 0; k < nops; k++) {   /* offset so they cannot clash with live PIDs */
+        sink += addjob(jobs, newpids[k] + PIDRANGE, BG, "bench\n");
+    }
+    report(dist, "addjob", nowns() - start, readmisses() - misses, nops);
+
+    free(idx);
+    free(newpids);
+}
+
+int main(int argc, char **argv)
+{
+    int c, nops, seed = 1;
+
+    while ((c = getopt(argc, argv, "s:")) != EOF) {
+        switch (c) {
+            case 's':
+                seed = atoi(optarg);
+                break;
+            default:
+                printf("Usage: %s [-s <seed>]\n", argv[0]);
+                exit(1);
+        }
+    }
+    srand(seed);
+
+    if ((pids = malloc(MAXJOBS * sizeof(pid_t))) == NULL) {
+        unix_error("malloc failed");
+    }
+    cachefd = openmisses();
+
+    /* keep the cost of one measurement roughly independent of MAXJOBS */
+    nops = TARGETOPS / MAXJOBS;
+    if (nops < 16) {
+        nops = 16;
+    }
+
+    printf("%-7s %-10s %-12s %12s %14s\n", "jobs", "pids", "op", "ns/op", "misses/op");
+    benchdist("sequential", 0, nops);
+    benchdist("random", 1, nops);
+    exit(0);
+}
@@ -1,33 +1,47 @@
 /* 
  * myint.c - Another handy routine for testing your tiny shell
  * 
- * usage: myint <n>
+ * usage: myint [-p <file>] <n>
  * Sleeps for <n> seconds and sends SIGINT to itself.
  *
+ * With -p, the CLOCK_MONOTONIC time (in ns) just before the kill is
+ * appended to <file> as a "<pid> <ns>" line. <file> may be a FIFO, so
+ * a harness can time how long the shell takes to report the job as
+ * terminated.
  */
 #include <stdio.h>
 #include <unistd.h>
 #include <stdlib.h>
+#include <string.h>
 #include <sys/types.h>
 #include <sys/wait.h>
 #include <signal.h>
+#include "stamp.h"
 
 int main(int argc, char **argv) 
 {
-    int i, secs;
+    int c, i, secs, fd = -1;
     pid_t pid; 
 
-    if (argc != 2) {
-	fprintf(stderr, "Usage: %s <n>\n", argv[0]);
+    while ((c = getopt(argc, argv, "p:")) != EOF) {
+	if (c == 'p')
+	    fd = openstamp(optarg);
+	else
+	    optind = argc + 1;
+    }
+    if (optind != argc - 1) {
+	fprintf(stderr, "Usage: %s [-p <file>] <n>\n", argv[0]);
 	exit(0);
     }
-    secs = atoi(argv[1]);
+    secs = atoi(argv[optind]);
 
     for (i=0; i < secs; i++)
        sleep(1);
 	
     pid = getpid(); 
 
+    if (fd >= 0)
+	stamp(fd, pid);
     if (kill(pid, SIGINT) < 0)
        fprintf(stderr, "kill (int) error");
 
@@ -1,24 +1,122 @@
-/* 
- * myspin.c - A handy program for testing your tiny shell 
- * 
- * usage: myspin <n>
- * Sleeps for <n> seconds in 1-second chunks.
+/*
+ * myspin.c - A handy program for testing your tiny shell
+ *
+ * usage: myspin [-c] [-t <threads>] [-m <MB>] <duration>
+ * Sleeps for <duration>, which is in seconds unless it ends in
+ * ns, us, ms or s and may be fractional ("myspin 2", "myspin 250us").
+ *     -c           burn <duration> of CPU time instead of sleeping
+ *     -t <threads> do it in <threads> threads at once (loads N cores)
+ *     -m <MB>      first allocate and touch <MB> megabytes
  *
  */
 #include <stdio.h>
 #include <unistd.h>
 #include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
+
+long long duration;     /* ns to sleep or burn */
+int burn = 0;           /* burn CPU instead of sleeping */
+
+void usage(char *prog)
+{
+    fprintf(stderr, "Usage: %s [-c] [-t <threads>] [-m <MB>] <duration>[ns|us|ms|s]\n", prog);
+    exit(0);
+}
+
+/* parsens - Convert "<number>[unit]" to ns, -1 if malformed */
+long long parsens(char *s)
+{
+    char *unit;
+    double val = strtod(s, &unit);
+
+    if (unit == s || val < 0)
+	return -1;
+    if (*unit == '\0' || !strcmp(unit, "s"))
+	return val * 1e9;
+    if (!strcmp(unit, "ms"))
+	return val * 1e6;
+    if (!strcmp(unit, "us"))
+	return val * 1e3;
+    if (!strcmp(unit, "ns"))
+	return val;
+    return -1;
+}
+
+long long clockns(clockid_t clk)
+{
+    struct timespec ts;
 
-int main(int argc, char **argv) 
+    clock_gettime(clk, &ts);
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+/* spin - Sleep or burn CPU for duration ns in the calling thread */
+void *spin(void *vargp)
+{
+    struct timespec ts;
+    long long end;
+    volatile unsigned long x = 0;
+
+    if (burn) {
+	/* CPU time, so time spent stopped or preempted does not count */
+	end = clockns(CLOCK_THREAD_CPUTIME_ID) + duration;
+	while (clockns(CLOCK_THREAD_CPUTIME_ID) < end) {
+	    int i;
+	    for (i = 0; i < 1000; i++)
+		x += i;
+	}
+	return NULL;
+    }
+
+    ts.tv_sec = duration / 1000000000LL;
+    ts.tv_nsec = duration % 1000000000LL;
+    while (clock_nanosleep(CLOCK_MONOTONIC, 0, &ts, &ts) == EINTR)
+	;
+    return NULL;
+}
+
+int main(int argc, char **argv)
 {
-    int i, secs;
+    int c, nthreads = 1;
+    long i, mb = 0, pagesize = sysconf(_SC_PAGESIZE);
+    char *mem;
+    pthread_t *tids;
+
+    while ((c = getopt(argc, argv, "ct:m:")) != EOF) {
+	switch (c) {
+	case 'c': burn = 1; break;
+	case 't': nthreads = atoi(optarg); break;
+	case 'm': mb = atol(optarg); break;
+	default: usage(argv[0]);
+	}
+    }
+    if (optind != argc - 1 || nthreads < 1 || mb < 0 ||
+	(duration = parsens(argv[optind])) < 0)
+	usage(argv[0]);
+
+    if (mb > 0) {
+	if ((mem = malloc(mb << 20)) == NULL) {
+	    fprintf(stderr, "malloc error\n");
+	    exit(1);
+	}
+	for (i = 0; i < (mb << 20) / pagesize; i++)
+	    mem[i * pagesize] = 1;
+    }
 
-    if (argc != 2) {
-	fprintf(stderr, "Usage: %s <n>\n", argv[0]);
-	exit(0);
+    if ((tids = malloc(nthreads * sizeof(pthread_t))) == NULL) {
+	fprintf(stderr, "malloc error\n");
+	exit(1);
     }
-    secs = atoi(argv[1]);
-    for (i=0; i < secs; i++)
-	sleep(1);
+    for (i = 1; i < nthreads; i++)
+	if ((errno = pthread_create(&tids[i], NULL, spin, NULL)) != 0) {
+	    perror("pthread_create error");
+	    exit(1);
+	}
+    spin(NULL);
+    for (i = 1; i < nthreads; i++)
+	pthread_join(tids[i], NULL);
     exit(0);
 }
@@ -1,35 +1,251 @@
-/* 
+/*
  * mysplit.c - Another handy routine for testing your tiny shell
- * 
- * usage: mysplit <n>
+ *
+ * usage: mysplit [-f <fanout>] [-d <depth>] [-g | -s] [-v] <n>
  * Fork a child that spins for <n> seconds in 1-second chunks.
+ *
+ * With -f and -d it builds a whole process tree instead: every process
+ * above <depth> forks <fanout> children and waits for them, and the
+ * leaves spin for <n> seconds. With -g every child of the top process
+ * starts its own process group, with -s its own session, so that
+ * signals sent to the job's process group reach only part of the tree.
+ *
+ * Every process in the tree records when it first receives SIGINT,
+ * SIGTSTP and SIGCONT (and still acts on them as usual). With -v the
+ * top process prints, when the tree is done or interrupted, how many
+ * processes each signal reached and the time between the first and
+ * the last delivery. Processes that SIGINT did not reach are killed
+ * so an interrupted tree leaves nothing behind.
  */
 #include <stdio.h>
 #include <unistd.h>
 #include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
 #include <sys/types.h>
 #include <sys/wait.h>
+#include <sys/mman.h>
 #include <signal.h>
 
-int main(int argc, char **argv) 
+#define MAXNODES 4096       /* max processes in the tree */
+#define SETTLE_US 100000    /* time for a signal to reach the whole tree */
+
+/* Recorded signals */
+#define RINT  0
+#define RTSTP 1
+#define RCONT 2
+#define NREC  3
+
+struct node_t {             /* One process of the tree */
+    pid_t pid;
+    int depth;              /* 0 for the top process */
+    long long first[NREC];  /* first delivery of each signal (ns), 0 if none */
+    int count[NREC];        /* deliveries of each signal */
+};
+
+struct tree_t {             /* The tree, in a mapping shared by all */
+    int nnodes;             /* slots handed out */
+    struct node_t nodes[MAXNODES];
+};
+
+struct tree_t *tree;
+struct node_t *self;        /* this process's slot */
+int fanout = 1, depth = 1, secs;
+int newpgrp = 0, newsess = 0;
+volatile sig_atomic_t gotint = 0;
+
+long long nowns(void)
 {
-    int i, secs;
+    struct timespec ts;
 
-    if (argc != 2) {
-	fprintf(stderr, "Usage: %s <n>\n", argv[0]);
-	exit(0);
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+void record(int which)
+{
+    if (self->count[which]++ == 0)
+	self->first[which] = nowns();
+}
+
+/*
+ * The handlers record the signal and then let it have its default
+ * effect, except that the top process postpones dying from SIGINT
+ * until it has reported.
+ */
+void sigint_handler(int sig)
+{
+    record(RINT);
+    if (self->depth == 0) {
+	gotint = 1;
+	return;
     }
-    secs = atoi(argv[1]);
+    signal(SIGINT, SIG_DFL);
+    raise(SIGINT);              /* delivered when the handler returns */
+}
+
+void sigtstp_handler(int sig)
+{
+    record(RTSTP);
+    signal(SIGTSTP, SIG_DFL);
+    raise(SIGTSTP);             /* stops us when the handler returns */
+}
+
+void sigcont_handler(int sig)
+{
+    record(RCONT);
+    signal(SIGTSTP, sigtstp_handler);
+}
+
+void install(int sig, void (*handler)(int))
+{
+    struct sigaction action;
+
+    action.sa_handler = handler;
+    sigemptyset(&action.sa_mask);
+    action.sa_flags = 0;        /* let wait() return on SIGINT */
+    sigaction(sig, &action, NULL);
+}
+
+/* join - Take a slot in the tree for the calling process */
+void join(int d)
+{
+    int i = __atomic_fetch_add(&tree->nnodes, 1, __ATOMIC_RELAXED);
 
+    self = &tree->nodes[i];
+    self->pid = getpid();
+    self->depth = d;
+}
+
+/*
+ * grow - Body of a process at depth d, which has joined the tree;
+ *    never returns
+ */
+void grow(int d)
+{
+    sigset_t mask, prev;
+    int i;
 
-    if (fork() == 0) { /* child */
-	for (i=0; i < secs; i++)
+    if (d == 1 && newsess)
+	setsid();
+    else if (d == 1 && newpgrp)
+	setpgid(0, 0);
+
+    if (d == depth) {           /* leaf */
+	for (i = 0; i < secs; i++)
 	    sleep(1);
 	exit(0);
     }
+    /* a child joins before it takes the signals it records */
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGINT);
+    sigaddset(&mask, SIGTSTP);
+    sigaddset(&mask, SIGCONT);
+    for (i = 0; i < fanout; i++) {
+	sigprocmask(SIG_BLOCK, &mask, &prev);
+	if (fork() == 0) {
+	    join(d + 1);
+	    sigprocmask(SIG_SETMASK, &prev, NULL);
+	    grow(d + 1);
+	}
+	sigprocmask(SIG_SETMASK, &prev, NULL);
+    }
+    if (d > 0) {
+	while (wait(NULL) > 0 || errno == EINTR)
+	    ;
+	exit(0);
+    }
+}
+
+/* report - Print how far each signal got through the tree */
+void report(void)
+{
+    char *names[NREC] = {"SIGINT", "SIGTSTP", "SIGCONT"};
+    int i, r, n = tree->nnodes, got;
+    long long first, last;
+
+    printf("tree: fanout %d depth %d, %d processes (%d descendants)\n",
+	   fanout, depth, n, n - 1);
+    for (r = 0; r < NREC; r++) {
+	got = 0;
+	first = last = 0;
+	for (i = 0; i < n; i++) {
+	    if (tree->nodes[i].count[r] == 0)
+		continue;
+	    if (tree->nodes[i].depth > 0)
+		got++;
+	    if (first == 0 || tree->nodes[i].first[r] < first)
+		first = tree->nodes[i].first[r];
+	    if (tree->nodes[i].first[r] > last)
+		last = tree->nodes[i].first[r];
+	}
+	printf("%-8s reached %s and %d/%d descendants", names[r],
+	       tree->nodes[0].count[r] ? "top" : "not top", got, n - 1);
+	if (first)
+	    printf(", spread %.1f us", (last - first) / 1e3);
+	printf("\n");
+    }
+    fflush(stdout);
+}
+
+int main(int argc, char **argv)
+{
+    int c, i, verbose = 0, nodes = 1, level = 1, killed = 0;
+
+    while ((c = getopt(argc, argv, "f:d:gsv")) != EOF) {
+	switch (c) {
+	case 'f': fanout = atoi(optarg); break;
+	case 'd': depth = atoi(optarg); break;
+	case 'g': newpgrp = 1; break;
+	case 's': newsess = 1; break;
+	case 'v': verbose = 1; break;
+	default: optind = argc + 1;
+	}
+    }
+    for (i = 0; i < depth && nodes < MAXNODES; i++)
+	nodes += (level *= fanout);
+    if (optind != argc - 1 || fanout < 1 || depth < 1 || nodes > MAXNODES) {
+	fprintf(stderr, "Usage: %s [-f <fanout>] [-d <depth>] [-g | -s] [-v] <n>\n", argv[0]);
+	exit(0);
+    }
+    secs = atoi(argv[optind]);
 
-    /* parent waits for child to terminate */
-    wait(NULL);
+    tree = mmap(NULL, sizeof(struct tree_t), PROT_READ | PROT_WRITE,
+		MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (tree == MAP_FAILED) {
+	perror("mmap error");
+	exit(1);
+    }
+    join(0);
+    install(SIGINT, sigint_handler);
+    install(SIGTSTP, sigtstp_handler);
+    install(SIGCONT, sigcont_handler);
+
+    grow(0);
+
+    /* parent waits for the tree to terminate */
+    while (!gotint && (wait(NULL) > 0 || errno == EINTR))
+	;
 
+    if (gotint) {
+	usleep(SETTLE_US);
+	for (i = 1; i < tree->nnodes; i++) {
+	    if (tree->nodes[i].count[RINT] == 0 && kill(tree->nodes[i].pid, SIGKILL) == 0)
+		killed++;
+	}
+	while (wait(NULL) > 0 || errno == EINTR)
+	    ;
+    }
+    if (verbose) {
+	report();
+	if (killed)
+	    printf("killed %d processes that SIGINT did not reach\n", killed);
+	fflush(stdout);
+    }
+    if (gotint) {
+	signal(SIGINT, SIG_DFL);
+	raise(SIGINT);
+    }
     exit(0);
 }
@@ -1,35 +1,53 @@
 /* 
  * mystop.c - Another handy routine for testing your tiny shell
  * 
- * usage: mystop <n>
+ * usage: mystop [-p <file>] [-r <times>] <n>
  * Sleeps for <n> seconds and sends SIGTSTP to itself.
  *
+ * With -r it does so <times> times, starting over each time it is
+ * continued. With -p, the CLOCK_MONOTONIC time (in ns) just before
+ * each kill is appended to <file> as a "<pid> <ns>" line. <file> may
+ * be a FIFO, so a harness can time how long the shell takes to report
+ * each stop, and get a distribution from a single job.
  */
 #include <stdio.h>
 #include <unistd.h>
 #include <stdlib.h>
+#include <string.h>
 #include <sys/types.h>
 #include <sys/wait.h>
 #include <signal.h>
+#include "stamp.h"
 
 int main(int argc, char **argv) 
 {
-    int i, secs;
+    int c, i, secs, times = 1, fd = -1;
     pid_t pid; 
 
-    if (argc != 2) {
-	fprintf(stderr, "Usage: %s <n>\n", argv[0]);
+    while ((c = getopt(argc, argv, "p:r:")) != EOF) {
+	switch (c) {
+	case 'p': fd = openstamp(optarg); break;
+	case 'r': times = atoi(optarg); break;
+	default: optind = argc + 1;
+	}
+    }
+    if (optind != argc - 1 || times < 1) {
+	fprintf(stderr, "Usage: %s [-p <file>] [-r <times>] <n>\n", argv[0]);
 	exit(0);
     }
-    secs = atoi(argv[1]);
+    secs = atoi(argv[optind]);
 
-    for (i=0; i < secs; i++)
-       sleep(1);
-	
     pid = getpid(); 
 
-    if (kill(-pid, SIGTSTP) < 0)
-       fprintf(stderr, "kill (tstp) error");
+    while (times-- > 0) {
+	for (i=0; i < secs; i++)
+	   sleep(1);
+
+	if (fd >= 0)
+	    stamp(fd, pid);
+	if (kill(-pid, SIGTSTP) < 0)
+	   fprintf(stderr, "kill (tstp) error");
+    }
 
     exit(0);
 
@@ -0,0 +1,408 @@
+/*
+ * mystress.c - Burst-spawn stress test for the SIGCHLD handling of tsh
+ *
+ * usage: mystress [-v] [-t <tsh>] [-n <children>] [-b <burst>]
+ *                 [-l <us>[:<us>]] [-e <code>|r] [-s <k>] [-k <k>] [-S <seed>]
+ * Starts <tsh> (default ./tsh) with an event trace and feeds it
+ * <children> short-lived background jobs, at most <burst> alive at a
+ * time, so that tsh's sigchld_handler has to reap them as they pile
+ * up. Every job lives for a random time between the two lifetimes (in
+ * microseconds), then exits with <code> (or a random code with -e r).
+ * With -s every k-th job stops itself halfway, and mystress has tsh
+ * continue it with bg; with -k every k-th job kills itself with
+ * SIGKILL instead of exiting.
+ *
+ * The jobs are mystress itself, run by tsh in a child mode. Each
+ * writes its CLOCK_MONOTONIC exit time to a shared file just before
+ * it exits, and tsh records the time it reaps each job in its trace.
+ * From the two, mystress checks that tsh reaped every job exactly
+ * once with the status it was expected to have, reports the reaping
+ * lag distribution, and exits with status 1 if any check failed.
+ * With -v the output of tsh is copied to stdout.
+ */
+#include <stdio.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include "trace.h"
+
+#define TSHMAXJOBS 16       /* size of the job list of tsh */
+#define STALLSECS 10        /* give up after this long without a reap */
+
+struct child_t {            /* One job and what we saw of it */
+    int code;               /* expected exit code */
+    int stop;               /* job stops itself halfway */
+    int kill;               /* job dies from SIGKILL */
+    long long lifetime;     /* lifetime in ns */
+    long long exitns;       /* set by the job right before exiting */
+    long long reapns;       /* when tsh reaped it, from the trace */
+    int reaped;             /* times reaped */
+    int stopped;            /* times reaped as stopped */
+    int badstatus;          /* reaped with an unexpected status */
+};
+
+struct child_t *children;   /* all jobs, in a file shared with them */
+int *pidslot;               /* PID -> index in children, -1 if none */
+int pidmax;                 /* size of pidslot */
+int nunknown = 0;           /* reaps of PIDs that are not live jobs */
+int verbose = 0;            /* copy the output of tsh */
+
+long long nowns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+void sleepns(long long ns)
+{
+    struct timespec ts;
+
+    ts.tv_sec = ns / 1000000000LL;
+    ts.tv_nsec = ns % 1000000000LL;
+    while (clock_nanosleep(CLOCK_MONOTONIC, 0, &ts, &ts) == EINTR)
+	;
+}
+
+void fail(char *msg)
+{
+    perror(msg);
+    exit(1);
+}
+
+/* rand64 - Return a random value of 62 bits, as rand() gives only 31 */
+long long rand64(void)
+{
+    return (long long)rand() << 31 | rand();
+}
+
+/* mapchildren - Map the file of n jobs open on fd */
+struct child_t *mapchildren(int fd, int n)
+{
+    struct child_t *c;
+
+    c = mmap(NULL, n * sizeof(struct child_t), PROT_READ | PROT_WRITE,
+	     MAP_SHARED, fd, 0);
+    if (c == MAP_FAILED)
+	fail("mmap error");
+    return c;
+}
+
+/* runchild - Body of job i, run by tsh; never returns */
+void runchild(char *file, int i)
+{
+    struct child_t *c;
+    int fd;
+
+    if ((fd = open(file, O_RDWR)) < 0)
+	fail(file);
+    c = &mapchildren(fd, i + 1)[i];
+    close(fd);
+    if (c->stop) {
+	sleepns(c->lifetime / 2);
+	kill(getpid(), SIGSTOP);
+	sleepns(c->lifetime - c->lifetime / 2);
+    }
+    else
+	sleepns(c->lifetime);
+    c->exitns = nowns();
+    if (c->kill)
+	kill(getpid(), SIGKILL);
+    _exit(c->code);
+}
+
+/* sendline - Write one command line to tsh */
+void sendline(int fd, char *line)
+{
+    size_t n = strlen(line);
+    ssize_t rc;
+
+    while (n > 0) {
+	if ((rc = write(fd, line, n)) < 0) {
+	    if (errno == EINTR)
+		continue;
+	    fail("write to tsh");
+	}
+	line += rc;
+	n -= rc;
+    }
+}
+
+/* drain - Read what tsh has printed, waiting up to ms for it */
+void drain(int fd, int ms)
+{
+    struct pollfd pfd = {fd, POLLIN, 0};
+    char buf[4096];
+    ssize_t n;
+
+    if (poll(&pfd, 1, ms) <= 0)
+	return;
+    if ((n = read(fd, buf, sizeof(buf))) > 0 && verbose &&
+	fwrite(buf, 1, n, stdout) < n)
+	exit(1);
+}
+
+/* maptrace - Map the trace tsh writes to file once tsh has set it up */
+struct tracehdr_t *maptrace(char *file)
+{
+    size_t size = sizeof(struct tracehdr_t) + TRACERECS * sizeof(struct tracerec_t);
+    struct tracehdr_t *hdr;
+    struct stat st;
+    long long start = nowns();
+    int fd;
+
+    for (;;) {
+	if (nowns() - start > STALLSECS * 1000000000LL) {
+	    fprintf(stderr, "tsh did not start its trace\n");
+	    exit(1);
+	}
+	if ((fd = open(file, O_RDONLY)) >= 0) {
+	    if (fstat(fd, &st) == 0 && st.st_size == size)
+		break;
+	    close(fd);
+	}
+	sleepns(1000000);
+    }
+    hdr = mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (hdr == MAP_FAILED)
+	fail("mmap error");
+    while (__atomic_load_n(&hdr->magic, __ATOMIC_ACQUIRE) != TRACEMAGIC)
+	sleepns(1000000);
+    if (hdr->version != TRACEVERSION || hdr->recsize != sizeof(struct tracerec_t) ||
+	hdr->nrecs != TRACERECS) {
+	fprintf(stderr, "trace of another tsh version\n");
+	exit(1);
+    }
+    return hdr;
+}
+
+int cmpll(const void *a, const void *b)
+{
+    long long x = *(long long *)a, y = *(long long *)b;
+    return x < y ? -1 : x > y;
+}
+
+void usage(char *prog)
+{
+    fprintf(stderr, "Usage: %s [-v] [-t <tsh>] [-n <children>] [-b <burst>] "
+	    "[-l <us>[:<us>]] [-e <code>|r] [-s <k>] [-k <k>] [-S <seed>]\n", prog);
+    fprintf(stderr, "<burst> is at most %d, the size of the job list of tsh\n",
+	    TSHMAXJOBS);
+    exit(1);
+}
+
+int main(int argc, char **argv)
+{
+    int c, i, n = 1000, burst = TSHMAXJOBS, code = 0, randcode = 0;
+    int stopevery = 0, killevery = 0, spawned = 0, forked = 0, alive = 0;
+    int nreaped = 0, nmissing = 0, ndup = 0, nbad = 0, nstop = 0, nexpstop = 0;
+    int status, fd, in[2], out[2];
+    long long minlife = 100000, maxlife = 100000, start, secs, lastreap, *lags;
+    unsigned long long next = 0;
+    char dir[] = "/tmp/mystress.XXXXXX", self[4096], file[64], tracefile[64];
+    char line[8192], *tsh = "./tsh";
+    struct tracehdr_t *hdr;
+    struct tracerec_t *ring, rec;
+    pid_t pid, tshpid;
+    ssize_t len;
+    FILE *fp;
+
+    /* a job run by tsh: mystress -c <file> <index> */
+    if (argc == 4 && !strcmp(argv[1], "-c"))
+	runchild(argv[2], atoi(argv[3]));
+
+    while ((c = getopt(argc, argv, "vt:n:b:l:e:s:k:S:")) != EOF) {
+	switch (c) {
+	case 'v': verbose = 1; break;
+	case 't': tsh = optarg; break;
+	case 'n': n = atoi(optarg); break;
+	case 'b': burst = atoi(optarg); break;
+	case 'l':
+	    minlife = maxlife = atoll(optarg);
+	    if (strchr(optarg, ':'))
+		maxlife = atoll(strchr(optarg, ':') + 1);
+	    break;
+	case 'e':
+	    if (!strcmp(optarg, "r"))
+		randcode = 1;
+	    else
+		code = atoi(optarg) & 0xff;
+	    break;
+	case 's': stopevery = atoi(optarg); break;
+	case 'k': killevery = atoi(optarg); break;
+	case 'S': srand(atoi(optarg)); break;
+	default: usage(argv[0]);
+	}
+    }
+    if (optind != argc || n < 1 || burst < 1 || burst > TSHMAXJOBS ||
+	minlife < 0 || maxlife < minlife)
+	usage(argv[0]);
+
+    pidmax = 4194304;
+    if ((fp = fopen("/proc/sys/kernel/pid_max", "r")) != NULL) {
+	if (fscanf(fp, "%d", &pidmax) != 1)
+	    pidmax = 4194304;
+	fclose(fp);
+    }
+    pidmax++;
+    if ((pidslot = malloc(pidmax * sizeof(int))) == NULL ||
+	(lags = malloc(n * sizeof(long long))) == NULL) {
+	fprintf(stderr, "malloc error\n");
+	exit(1);
+    }
+    memset(pidslot, 0xff, pidmax * sizeof(int));
+    if ((len = readlink("/proc/self/exe", self, sizeof(self) - 1)) < 0)
+	fail("readlink error");
+    self[len] = '\0';
+
+    /* plan every job up front, in a file the jobs map */
+    if (mkdtemp(dir) == NULL)
+	fail("mkdtemp error");
+    sprintf(file, "%s/children", dir);
+    sprintf(tracefile, "%s/trace", dir);
+    if ((fd = open(file, O_RDWR | O_CREAT | O_EXCL, 0600)) < 0)
+	fail(file);
+    if (ftruncate(fd, n * sizeof(struct child_t)) < 0)
+	fail("ftruncate error");
+    children = mapchildren(fd, n);
+    close(fd);
+    for (i = 0; i < n; i++) {
+	children[i].code = randcode ? rand() & 0xff : code;
+	children[i].stop = stopevery > 0 && i % stopevery == stopevery - 1;
+	children[i].kill = killevery > 0 && i % killevery == killevery - 1;
+	children[i].lifetime = minlife;
+	if (maxlife > minlife)
+	    children[i].lifetime += rand64() % (maxlife - minlife + 1);
+	children[i].lifetime *= 1000;
+	nexpstop += children[i].stop;
+    }
+
+    /* start tsh on a pair of pipes */
+    if (pipe(in) < 0 || pipe(out) < 0)
+	fail("pipe error");
+    signal(SIGPIPE, SIG_IGN);
+    if ((tshpid = fork()) < 0)
+	fail("fork error");
+    if (tshpid == 0) {
+	dup2(in[0], STDIN_FILENO);
+	dup2(out[1], STDOUT_FILENO);
+	dup2(out[1], STDERR_FILENO);
+	close(in[0]); close(in[1]); close(out[0]); close(out[1]);
+	execl(tsh, tsh, "-p", "-t", tracefile, (char *)NULL);
+	fail(tsh);
+    }
+    close(in[0]);
+    close(out[1]);
+    hdr = maptrace(tracefile);
+    ring = (struct tracerec_t *)(hdr + 1);
+
+    start = lastreap = nowns();
+    while (nreaped + nmissing < n) {
+	/* keep burst jobs alive */
+	for (; spawned < n && alive < burst; spawned++, alive++) {
+	    sprintf(line, "%s -c %s %d &\n", self, file, spawned);
+	    sendline(in[1], line);
+	}
+
+	/* follow the trace: forks map pids to jobs, reaps are checked */
+	while (next < __atomic_load_n(&hdr->head, __ATOMIC_ACQUIRE)) {
+	    if (hdr->head - next > TRACERECS) {
+		fprintf(stderr, "trace ring overran\n");
+		exit(1);
+	    }
+	    if (__atomic_load_n(&ring[next % TRACERECS].seq, __ATOMIC_ACQUIRE) !=
+		(unsigned int)(next + 1))
+		break;      /* still being written */
+	    rec = ring[next % TRACERECS];
+	    next++;
+	    if (rec.event == TR_FORK && rec.pid == tshpid) {
+		if (rec.arg[0] < pidmax && forked < n)
+		    pidslot[rec.arg[0]] = forked;
+		forked++;
+		continue;
+	    }
+	    if (rec.event != TR_REAP || rec.pid != tshpid)
+		continue;
+	    pid = rec.arg[0];
+	    status = rec.arg[1];
+	    if (pid >= pidmax || (i = pidslot[pid]) < 0) {
+		nunknown++;
+		continue;
+	    }
+	    if (WIFSTOPPED(status)) {
+		children[i].stopped++;
+		sprintf(line, "bg %d\n", pid);
+		sendline(in[1], line);
+		continue;
+	    }
+	    children[i].reapns = rec.ns;
+	    children[i].reaped++;
+	    if (children[i].kill ? !(WIFSIGNALED(status) && WTERMSIG(status) == SIGKILL)
+		                 : !(WIFEXITED(status) && WEXITSTATUS(status) == children[i].code))
+		children[i].badstatus++;
+	    pidslot[pid] = -1;
+	    lastreap = nowns();
+	    nreaped++;
+	    alive--;
+	}
+
+	if (nowns() - lastreap > STALLSECS * 1000000000LL + maxlife * 1000) {
+	    nmissing = n - nreaped;
+	    break;
+	}
+	drain(out[0], 1);
+    }
+    secs = nowns() - start;
+
+    sendline(in[1], "quit\n");
+    close(in[1]);
+    while ((len = read(out[0], line, sizeof(line))) > 0)
+	if (verbose && fwrite(line, 1, len, stdout) < len)
+	    exit(1);
+    waitpid(tshpid, NULL, 0);
+
+    /* verify */
+    nreaped = 0;
+    for (i = 0; i < n; i++) {
+	struct child_t *ch = &children[i];
+	if (ch->reaped > 0) {
+	    lags[nreaped++] = ch->reapns - ch->exitns;
+	    if (ch->reaped > 1)
+		ndup++;
+	}
+	nbad += ch->badstatus > 0;
+	nstop += ch->stopped;
+    }
+    qsort(lags, nreaped, sizeof(long long), cmpll);
+    unlink(file);
+    unlink(tracefile);
+    rmdir(dir);
+
+    printf("children %d burst %d lifetime %lld-%lldus elapsed %.3fs (%.0f children/s)\n",
+	   n, burst, minlife, maxlife, secs / 1e9, n / (secs / 1e9));
+    printf("reaped %d missing %d duplicate %d unknown %d badstatus %d\n",
+	   nreaped, nmissing, ndup, nunknown, nbad);
+    printf("stops %d/%d\n", nstop, nexpstop);
+    if (nreaped > 0)
+	printf("reap lag us: min %.1f median %.1f p90 %.1f p99 %.1f max %.1f\n",
+	       lags[0] / 1e3, lags[nreaped / 2] / 1e3, lags[nreaped * 90 / 100] / 1e3,
+	       lags[nreaped * 99 / 100] / 1e3, lags[nreaped - 1] / 1e3);
+
+    if (nmissing || ndup || nunknown || nbad || nstop != nexpstop) {
+	printf("FAIL\n");
+	exit(1);
+    }
+    printf("OK\n");
+    exit(0);
+}
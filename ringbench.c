@@ -0,0 +1,193 @@
+/*
+ * ringbench.c - Loopback benchmark of the io_uring backend for Rio
+ *
+ * usage: ringbench [-h] [-s <MB>] [-r <bytes>] [-c <conns>]
+ * A child process streams <MB> megabytes of <bytes>-byte records over
+ * <conns> loopback TCP connections (default: runs with 1, 16 and 64),
+ * one thread per connection. The parent reads all the records, going
+ * round the connections and asking for more data whenever a rio_t
+ * holds less than a record, in three ways:
+ *     read         one read(2) per refill (a ring without io_uring)
+ *     uring        all the refills of a round in one io_uring_enter
+ *     uring-fixed  the same with the rio_bufs registered with the ring
+ * and prints MB/s and the system calls it took to get the data.
+ */
+#include "csapp.h"
+
+#define CHUNK (1 << 16)     /* server write size */
+
+int mb = 1024;              /* total data per run */
+int recsize = 512;          /* record size */
+char chunk[CHUNK];          /* what the server writes, whole records */
+
+/* now - Return the monotonic clock in seconds */
+double now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* sendrecords - Server thread: stream the records of one connection */
+void *sendrecords(void *vargp)
+{
+    int fd = (int)(long)vargp, i;
+    long long left = (long long)mb * (1 << 20) / recsize;
+    int perchunk = CHUNK / recsize;
+
+    while (left > 0) {
+        i = left < perchunk ? left : perchunk;
+        Rio_writen(fd, chunk, i * recsize);
+        left -= i;
+    }
+    Close(fd);
+    return NULL;
+}
+
+/* serve - Start a server child that streams to nconns connections */
+pid_t serve(int listenfd, int nconns)
+{
+    pthread_t *tids;
+    pid_t pid;
+    int i;
+
+    fflush(stdout);
+    if ((pid = Fork()) > 0)
+        return pid;
+
+    /* each connection gets its share of the data */
+    mb = mb / nconns > 0 ? mb / nconns : 1;
+    for (i = 0; i < CHUNK; i++)
+        chunk[i] = i % recsize == recsize - 1 ? '\n' : 'a' + i % 26;
+    tids = Malloc(nconns * sizeof(pthread_t));
+    for (i = 0; i < nconns; i++)
+        Pthread_create(&tids[i], NULL, sendrecords,
+                       (void *)(long)Accept(listenfd, NULL, NULL));
+    for (i = 0; i < nconns; i++)
+        Pthread_join(tids[i], NULL);
+    exit(0);
+}
+
+/*
+ * run - Read every record from nconns connections through one ring;
+ *    mode 0 has no io_uring, mode 2 registers the buffers
+ */
+void run(int listenfd, int port, int nconns, int mode)
+{
+    static char *names[] = {"read", "uring", "uring-fixed"};
+    char rec[MAXBUF];
+    rio_t **rps;
+    rio_ring_t ring;
+    long long quota, *left, bytes = 0;
+    unsigned long nsys = 0;
+    int i, active;
+    double start, secs;
+    pid_t pid;
+
+    if (mode == 0) {
+        memset(&ring, 0, sizeof(ring));
+        ring.fd = -1;
+    }
+    else if (rio_ringinit(&ring, 256) < 0) {
+        printf("%-6d %-12s %10s\n", nconns, names[mode], "n/a");
+        return;
+    }
+    pid = serve(listenfd, nconns);
+    quota = (long long)(mb / nconns > 0 ? mb / nconns : 1) * (1 << 20) / recsize;
+    rps = Malloc(nconns * sizeof(rio_t *));
+    left = Malloc(nconns * sizeof(long long));
+    for (i = 0; i < nconns; i++) {
+        rps[i] = Malloc(sizeof(rio_t));
+        Rio_readinitb(rps[i], Open_clientfd("localhost", port));
+        left[i] = quota;
+    }
+    if (mode == 2 && rio_ringregister(&ring, rps, nconns) < 0)
+        unix_error("rio_ringregister error");
+
+    start = now();
+    for (active = nconns; active > 0; ) {
+        for (i = 0; i < nconns; i++) {
+            if (left[i] == 0)
+                continue;
+            while (rps[i]->rio_cnt >= recsize && left[i] > 0) {
+                Rio_readnb(rps[i], rec, recsize);
+                bytes += recsize;
+                left[i]--;
+            }
+            if (left[i] == 0)
+                active--;
+            else {
+                Rio_ringread(&ring, rps[i]);
+                nsys += mode == 0;
+            }
+        }
+        Rio_ringwait(&ring, ring.inflight);
+        for (i = 0; i < nconns; i++) {
+            if (left[i] > 0 && rps[i]->rio_ringres <= 0)
+                app_error("ringbench: connection closed early");
+        }
+    }
+    secs = now() - start;
+    if (mode > 0)
+        nsys = ring.nenter;
+
+    printf("%-6d %-12s %10.1f %12lu %12.1f\n", nconns, names[mode],
+           bytes / secs / (1 << 20), nsys, bytes / 1024.0 / nsys);
+    for (i = 0; i < nconns; i++) {
+        Close(rps[i]->rio_fd);
+        Free(rps[i]);
+    }
+    Free(rps);
+    Free(left);
+    if (mode > 0)
+        rio_ringfree(&ring);
+    Waitpid(pid, NULL, 0);
+}
+
+void usage(char *prog)
+{
+    printf("Usage: %s [-h] [-s <MB>] [-r <bytes>] [-c <conns>]\n", prog);
+    printf("   -h          print this message\n");
+    printf("   -s <MB>     data per run (default 1024)\n");
+    printf("   -r <bytes>  record size (default 512)\n");
+    printf("   -c <conns>  only run with this many connections\n");
+    exit(1);
+}
+
+int main(int argc, char **argv)
+{
+    int c, i, mode, listenfd, port, nconns = 0;
+    int sizes[] = {1, 16, 64};
+    struct sockaddr_storage addr;
+    socklen_t len = sizeof(addr);
+    char service[NI_MAXSERV];
+
+    while ((c = getopt(argc, argv, "hs:r:c:")) != EOF) {
+        switch (c) {
+        case 's': mb = atoi(optarg); break;
+        case 'r': recsize = atoi(optarg); break;
+        case 'c': nconns = atoi(optarg); break;
+        default:  usage(argv[0]);
+        }
+    }
+    if (optind != argc || mb < 1 || recsize < 1 || recsize > MAXBUF ||
+        recsize > CHUNK || nconns < 0)
+        usage(argv[0]);
+
+    Signal(SIGPIPE, SIG_IGN);
+    listenfd = Open_listenfd(0);
+    if (getsockname(listenfd, (SA *)&addr, &len) < 0)
+        unix_error("getsockname error");
+    Getnameinfo((SA *)&addr, len, NULL, 0, service, sizeof(service), NI_NUMERICSERV);
+    port = atoi(service);
+
+    printf("%-6s %-12s %10s %12s %12s\n", "conns", "mode", "MB/s", "syscalls", "KB/syscall");
+    for (i = 0; i < 3; i++) {
+        if (nconns > 0 && i > 0)
+            break;
+        for (mode = 0; mode < 3; mode++)
+            run(listenfd, port, nconns > 0 ? nconns : sizes[i], mode);
+    }
+    exit(0);
+}
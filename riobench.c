@@ -0,0 +1,303 @@
+/*
+ * riobench.c - Throughput benchmark for the Rio line reader
+ *
+ * usage: riobench [-h] [-s <MB>] [-l <bytes>] [-b <bytes>] [<file>]
+ * Reads a stream line by line with rio_readlineb, with rio_viewlineb
+ * (no copy) and, as a baseline, with the original byte-at-a-time
+ * reader, and prints MB/s for each. Every reader looks at the first
+ * byte of each line, as a parser would. The copying and viewing
+ * readers run once more with a heap buffer that grows from 4 KB up to
+ * 1 MB, and the final size of that buffer is shown. With -b, the
+ * other readers use a buffer of that size instead of the rio_t's own.
+ * When the input is a regular file, they also run on the file mapped
+ * with rio_readinitmmap.
+ * The stream is <file> if one is given, otherwise <MB> megabytes of
+ * generated text (lines of 1 to 2*<bytes> bytes) that a child process
+ * writes into a pipe, so inputs of many GB need no disk space.
+ */
+#include "csapp.h"
+
+#define PATTERN (1 << 20)   /* size of the generated text block */
+
+int mb = 1024;              /* generated input size */
+int linelen = 80;           /* mean generated line length */
+long bufsize = 0;           /* -b buffer size, 0 for the built-in one */
+char *file = NULL;          /* input file, NULL to generate */
+
+/* now - Return the monotonic clock in seconds */
+double now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/*
+ * bytewise_read, bytewise_readlineb - The reader as it was before
+ *    rio_readlineb scanned for the newline with memchr.
+ */
+static ssize_t bytewise_read(rio_t *rp, char *usrbuf, size_t n)
+{
+    int cnt;
+
+    while (rp->rio_cnt <= 0) {
+        rp->rio_cnt = read(rp->rio_fd, rp->rio_base, rp->rio_size);
+        if (rp->rio_cnt < 0) {
+            if (errno != EINTR)
+                return -1;
+        }
+        else if (rp->rio_cnt == 0)
+            return 0;
+        else
+            rp->rio_bufptr = rp->rio_base;
+    }
+    cnt = n;
+    if (rp->rio_cnt < n)
+        cnt = rp->rio_cnt;
+    memcpy(usrbuf, rp->rio_bufptr, cnt);
+    rp->rio_bufptr += cnt;
+    rp->rio_cnt -= cnt;
+    return cnt;
+}
+
+ssize_t bytewise_readlineb(rio_t *rp, void *usrbuf, size_t maxlen)
+{
+    int n, rc;
+    char c, *bufp = usrbuf;
+
+    for (n = 1; n < maxlen; n++) {
+        if ((rc = bytewise_read(rp, &c, 1)) == 1) {
+            *bufp++ = c;
+            if (c == '\n')
+                break;
+        } else if (rc == 0) {
+            if (n == 1)
+                return 0;
+            else
+                break;
+        } else
+            return -1;
+    }
+    *bufp = 0;
+    return n;
+}
+
+/*
+ * The readers under test: each returns the length of the next line
+ * and points *linep at it.
+ */
+char line[MAXBUF];
+
+ssize_t bytewise(rio_t *rp, char **linep)
+{
+    ssize_t n = bytewise_readlineb(rp, line, sizeof(line));
+
+    *linep = line;
+    return n > 0 && line[n - 1] != '\n' ? n - 1 : n;
+}
+
+ssize_t memchrcopy(rio_t *rp, char **linep)
+{
+    ssize_t n = rio_readlineb(rp, line, sizeof(line));
+
+    *linep = line;
+    return n > 0 && line[n - 1] != '\n' ? n - 1 : n;
+}
+
+ssize_t view(rio_t *rp, char **linep)
+{
+    return rio_viewlineb(rp, linep, line, sizeof(line));
+}
+
+/* openinput - Open the input stream; *pid is the generator or 0 */
+int openinput(pid_t *pid)
+{
+    int fds[2], len;
+    long i, left;
+    char *text;
+
+    *pid = 0;
+    if (file != NULL)
+        return Open(file, O_RDONLY, 0);
+
+    if (pipe(fds) < 0)
+        unix_error("pipe error");
+    fflush(stdout);             /* or the child prints it again */
+    if ((*pid = Fork()) == 0) {
+        Close(fds[0]);
+        srand(1);
+        text = Malloc(PATTERN);
+        for (i = 0; i < PATTERN; i += len) {
+            len = 1 + rand() % (2 * linelen);
+            if (i + len > PATTERN)      /* runs on into the next block */
+                len = PATTERN - i;
+            memset(text + i, 'a' + i % 26, len - 1);
+            text[i + len - 1] = '\n';
+        }
+        for (left = (long)mb << 20; left > 0; left -= PATTERN)
+            Rio_writen(fds[1], text, left < PATTERN ? left : PATTERN);
+        exit(0);
+    }
+    Close(fds[1]);
+    return fds[0];
+}
+
+/* How run reads the input */
+#define OWNBUF 0            /* the rio_t's own buffer (or the -b one) */
+#define HEAPBUF 1           /* a heap buffer that may grow */
+#define MAPPED 2            /* the file mapped into memory */
+
+/* run - Read the whole input with one reader and report its throughput */
+void run(char *name, ssize_t (*readline)(rio_t *, char **), int how)
+{
+    static char *buf;
+    rio_t rio;
+    char *linep;
+    unsigned char sum = 0;
+    double start, secs;
+    long long bytes = 0, lines = 0;
+    ssize_t n;
+    size_t size;
+    pid_t pid;
+    int fd;
+
+    fd = openinput(&pid);
+    if (how == MAPPED)
+        Rio_readinitmmap(&rio, fd);
+    else if (how == HEAPBUF)
+        Rio_readinitheap(&rio, fd, 4096, 1 << 20);
+    else if (bufsize > 0) {
+        if (buf == NULL)
+            buf = Malloc(bufsize);
+        rio_readinitbuf(&rio, fd, buf, bufsize);
+    }
+    else
+        Rio_readinitb(&rio, fd);
+    start = now();
+    while ((n = readline(&rio, &linep)) > 0) {
+        bytes += n;
+        sum += linep[0];
+        lines++;
+    }
+    secs = now() - start;
+    if (n < 0)
+        unix_error("readline error");
+    size = rio.rio_size;
+    rio_freeb(&rio);
+    Close(fd);
+    if (pid > 0)
+        Waitpid(pid, NULL, 0);
+    printf("%-10s %14lld %12lld %10.3f %10.1f %4d %8zu\n", name, bytes, lines,
+           secs, bytes / secs / (1 << 20), sum, size);
+}
+
+/* drain - Start a child that reads and discards everything from a pipe */
+int drain(pid_t *pid)
+{
+    int fds[2];
+    static char buf[1 << 16];
+
+    if (pipe(fds) < 0)
+        unix_error("pipe error");
+    fflush(stdout);
+    if ((*pid = Fork()) == 0) {
+        Close(fds[1]);
+        while (Read(fds[0], buf, sizeof(buf)) > 0)
+            ;
+        exit(0);
+    }
+    Close(fds[0]);
+    return fds[1];
+}
+
+/* runwrite - Write the responses piece by piece or through a rio_wt */
+void runwrite(char *name, int buffered)
+{
+    static char body[16384];
+    char line[64];
+    rio_wt rio;
+    double start, secs;
+    long long bytes = 0, responses = 0;
+    int fd, i, n;
+    pid_t pid;
+
+    memset(body, 'x', sizeof(body));
+    fd = drain(&pid);
+    Rio_writeinitb(&rio, fd);
+    start = now();
+    while (bytes < (long long)mb << 20) {
+        for (i = 0; i < 8; i++) {
+            n = sprintf(line, "X-Header-%d: response %lld\r\n", i, responses);
+            if (buffered)
+                Rio_writenb(&rio, line, n);
+            else
+                Rio_writen(fd, line, n);
+            bytes += n;
+        }
+        n = responses % 4 == 3 ? sizeof(body) : 200;
+        if (buffered) {
+            Rio_writenb(&rio, "\r\n", 2);
+            Rio_writenb(&rio, body, n);
+            Rio_flushb(&rio);
+        } else {
+            Rio_writen(fd, "\r\n", 2);
+            Rio_writen(fd, body, n);
+        }
+        bytes += n + 2;
+        responses++;
+    }
+    Close(fd);
+    Waitpid(pid, NULL, 0);
+    secs = now() - start;
+    printf("%-10s %14lld %12lld %10.3f %10.1f %12.0f\n", name, bytes, responses,
+           secs, bytes / secs / (1 << 20), responses / secs);
+}
+
+void usage(char *prog)
+{
+    printf("Usage: %s [-h] [-s <MB>] [-l <bytes>] [-b <bytes>] [<file>]\n", prog);
+    printf("   -h          print this message\n");
+    printf("   -s <MB>     size of the generated input (default 1024)\n");
+    printf("   -l <bytes>  mean length of a generated line (default 80)\n");
+    printf("   -b <bytes>  read through a buffer of this size (default %d)\n", RIO_BUFSIZE);
+    printf("   <file>      read this file instead of generated input\n");
+    exit(1);
+}
+
+int main(int argc, char **argv)
+{
+    struct stat st;
+    int c;
+
+    while ((c = getopt(argc, argv, "hs:l:b:")) != EOF) {
+        switch (c) {
+        case 's': mb = atoi(optarg); break;
+        case 'l': linelen = atoi(optarg); break;
+        case 'b': bufsize = atol(optarg); break;
+        default:  usage(argv[0]);
+        }
+    }
+    if (optind < argc - 1 || bufsize < 0 || mb < 1 || linelen < 1 || linelen > MAXBUF / 4)
+        usage(argv[0]);
+    if (optind == argc - 1)
+        file = argv[optind];
+
+    printf("%-10s %14s %12s %10s %10s %4s %8s\n", "reader", "bytes", "lines",
+           "seconds", "MB/s", "sum", "bufsize");
+    run("bytewise", bytewise, OWNBUF);
+    run("memchr", memchrcopy, OWNBUF);
+    run("view", view, OWNBUF);
+    run("memchr", memchrcopy, HEAPBUF);
+    run("view", view, HEAPBUF);
+    if (file != NULL && stat(file, &st) == 0 && S_ISREG(st.st_mode)) {
+        run("memchr", memchrcopy, MAPPED);
+        run("view", view, MAPPED);
+    }
+
+    printf("\n%-10s %14s %12s %10s %10s %12s\n", "writer", "bytes", "responses",
+           "seconds", "MB/s", "responses/s");
+    runwrite("writen", 0);
+    runwrite("writenb", 1);
+    exit(0);
+}
@@ -0,0 +1,330 @@
+/*
+ * sdriver.c - Trace-driven regression driver for the tiny shell
+ *
+ * usage: sdriver [-hgv] [-s <shell>] [-a <args>] [-j <n>] [-T <secs>] <trace>...
+ * Runs each trace file against "<shell> <args>", feeding it the
+ * command lines of the trace on stdin, and compares everything the
+ * shell prints with the reference output in the matching .ref file
+ * (trace01.txt -> trace01.ref). Traces run in parallel, one shell per
+ * trace, and the wall time of every trace is reported.
+ *
+ * Trace files contain shell command lines plus these driver commands:
+ *     # ...      comment, ignored
+ *     SLEEP <n>  sleep for <n> seconds (may be fractional)
+ *     INT        send SIGINT to the shell (as if ctrl-c was typed)
+ *     TSTP       send SIGTSTP to the shell (as if ctrl-z was typed)
+ *     QUIT       send SIGQUIT to the shell
+ *     KILL       send SIGKILL to the shell
+ *     CLOSE      close the shell's stdin (EOF)
+ *     WAIT       wait for the shell to terminate
+ * A trace that ends without WAIT is closed and waited for implicitly.
+ *
+ * Process IDs differ from run to run, so every "(<digits>)" in both
+ * outputs is replaced by "(PID)" before they are compared.
+ */
+#include "csapp.h"
+
+#define MAXTRACES  256   /* max traces per run */
+#define MAXDIFFS    10   /* mismatching lines shown per failed trace */
+
+/* Trace results */
+#define PASS    0
+#define FAIL    1
+#define TIMEOUT 2
+#define ERROR   3
+
+struct trace_t {            /* A trace being run */
+    char *path;             /* trace file */
+    pid_t pid;              /* worker running it, 0 if not started */
+    double start;           /* wall clock at start */
+    double secs;            /* wall time */
+    int result;             /* PASS, FAIL, TIMEOUT or ERROR */
+};
+
+char *shell = "./tsh";      /* shell under test */
+char *shellargs = "-p";     /* arguments passed to the shell */
+int timeout = 10;           /* seconds the shell gets to exit after EOF */
+int generate = 0;           /* write .ref files instead of comparing */
+int verbose = 0;            /* print the output of every trace */
+
+/* now - Return the wall clock in seconds */
+double now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* refpath - Return the reference output file of a trace */
+char *refpath(char *path)
+{
+    char *ref = Malloc(strlen(path) + 5);
+    char *dot;
+
+    strcpy(ref, path);
+    if ((dot = strrchr(ref, '.')) != NULL && strchr(dot, '/') == NULL)
+        *dot = '\0';
+    strcat(ref, ".ref");
+    return ref;
+}
+
+/* normalize - Replace every parenthesized number in buf by (PID) */
+char *normalize(char *buf)
+{
+    char *out = Malloc(strlen(buf) * 2 + 1);
+    char *src = buf, *dst = out, *end;
+
+    while (*src) {
+        if (*src == '(' && isdigit((unsigned char)src[1])) {
+            for (end = src + 1; isdigit((unsigned char)*end); end++)
+                ;
+            if (*end == ')') {
+                strcpy(dst, "(PID)");
+                dst += 5;
+                src = end + 1;
+                continue;
+            }
+        }
+        *dst++ = *src++;
+    }
+    *dst = '\0';
+    return out;
+}
+
+/* readfile - Read a whole file into a NUL-terminated buffer, NULL if absent */
+char *readfile(char *path)
+{
+    int fd;
+    struct stat st;
+    char *buf;
+
+    if ((fd = open(path, O_RDONLY)) < 0)
+        return NULL;
+    Fstat(fd, &st);
+    buf = Malloc(st.st_size + 1);
+    buf[Rio_readn(fd, buf, st.st_size)] = '\0';
+    Close(fd);
+    return buf;
+}
+
+/* difflines - Print the first mismatching lines of two outputs */
+void difflines(char *name, char *want, char *got)
+{
+    int line = 1, shown = 0;
+    char *wend, *gend;
+
+    while ((*want || *got) && shown < MAXDIFFS) {
+        if ((wend = strchr(want, '\n')) == NULL)
+            wend = want + strlen(want);
+        if ((gend = strchr(got, '\n')) == NULL)
+            gend = got + strlen(got);
+        if (wend - want != gend - got || memcmp(want, got, wend - want)) {
+            printf("  %s:%d\n    - %.*s\n    + %.*s\n", name, line,
+                   (int)(wend - want), want, (int)(gend - got), got);
+            shown++;
+        }
+        want = *wend ? wend + 1 : wend;
+        got = *gend ? gend + 1 : gend;
+        line++;
+    }
+}
+
+/* waitshell - Wait up to secs for the shell to exit; 0 on timeout */
+int waitshell(pid_t pid, double secs)
+{
+    double deadline = now() + secs;
+
+    while (now() < deadline) {
+        if (Waitpid(pid, NULL, WNOHANG) == pid)
+            return 1;
+        usleep(1000);
+    }
+    return 0;
+}
+
+/*
+ * runtrace - Run one trace against a fresh shell. Called in a worker
+ *    process; returns the trace result.
+ */
+int runtrace(char *path)
+{
+    char line[MAX_LINE], outname[] = "/tmp/sdriverXXXXXX";
+    char *argv[MAX_LINE / 2], *args, *ref, *out, *want;
+    int infd[2], outfd, argc = 0, closed = 0, waited = 0, result;
+    off_t size;
+    pid_t pid;
+    FILE *fp;
+
+    if ((fp = fopen(path, "r")) == NULL) {
+        printf("%s: %s\n", path, strerror(errno));
+        return ERROR;
+    }
+
+    /* the shell writes all its output to an unlinked temporary file */
+    if ((outfd = mkstemp(outname)) < 0)
+        unix_error("mkstemp error");
+    unlink(outname);
+    if (pipe(infd) < 0)
+        unix_error("pipe error");
+
+    args = strdup(shellargs);
+    argv[argc++] = shell;
+    for (argv[argc] = strtok(args, " "); argv[argc] != NULL; argv[argc] = strtok(NULL, " "))
+        argc++;
+
+    if ((pid = Fork()) == 0) {
+        Dup2(infd[0], 0);
+        Dup2(outfd, 1);
+        Dup2(outfd, 2);
+        Close(infd[0]);
+        Close(infd[1]);
+        Close(outfd);
+        execv(shell, argv);
+        unix_error("execv error");
+    }
+    Close(infd[0]);
+
+    /* feed the trace to the shell */
+    while (Fgets(line, sizeof(line), fp) != NULL) {
+        if (line[0] == '#' || line[0] == '\n')
+            continue;
+        if (!strncmp(line, "SLEEP", 5))
+            usleep(atof(line + 5) * 1000000);
+        else if (!strcmp(line, "INT\n"))
+            kill(pid, SIGINT);
+        else if (!strcmp(line, "TSTP\n"))
+            kill(pid, SIGTSTP);
+        else if (!strcmp(line, "QUIT\n"))
+            kill(pid, SIGQUIT);
+        else if (!strcmp(line, "KILL\n"))
+            kill(pid, SIGKILL);
+        else if (!strcmp(line, "CLOSE\n")) {
+            if (!closed)
+                Close(infd[1]);
+            closed = 1;
+        }
+        else if (!strcmp(line, "WAIT\n")) {
+            waited = waitshell(pid, timeout) ? 1 : -1;
+            if (waited < 0)
+                break;
+        }
+        else if (!closed)
+            rio_writen(infd[1], line, strlen(line));
+    }
+    Fclose(fp);
+
+    if (!closed)
+        Close(infd[1]);
+    if (waited < 0 || (!waited && !waitshell(pid, timeout))) {
+        kill(pid, SIGKILL);
+        Waitpid(pid, NULL, 0);
+        printf("%s: shell did not exit within %d seconds\n", path, timeout);
+        return TIMEOUT;
+    }
+
+    /* collect and compare the output */
+    size = Lseek(outfd, 0, SEEK_END);
+    out = Malloc(size + 1);
+    out[pread(outfd, out, size, 0)] = '\0';
+    Close(outfd);
+    ref = refpath(path);
+
+    if (verbose)
+        printf("%s output:\n%s", path, out);
+    if (generate) {
+        outfd = Open(ref, O_WRONLY | O_CREAT | O_TRUNC, DEF_MODE);
+        Rio_writen(outfd, out, strlen(out));
+        Close(outfd);
+        return PASS;
+    }
+    if ((want = readfile(ref)) == NULL) {
+        printf("%s: no reference output %s\n", path, ref);
+        return ERROR;
+    }
+    want = normalize(want);
+    out = normalize(out);
+    result = strcmp(want, out) ? FAIL : PASS;
+    if (result == FAIL)
+        difflines(ref, want, out);
+    return result;
+}
+
+void usage(char *prog)
+{
+    printf("Usage: %s [-hgv] [-s <shell>] [-a <args>] [-j <n>] [-T <secs>] <trace>...\n", prog);
+    printf("   -h         print this message\n");
+    printf("   -g         write the .ref files from the shell's output\n");
+    printf("   -v         print the output of every trace\n");
+    printf("   -s <shell> shell to test (default ./tsh)\n");
+    printf("   -a <args>  shell arguments (default \"-p\")\n");
+    printf("   -j <n>     traces to run in parallel (default: online CPUs)\n");
+    printf("   -T <secs>  time the shell gets to exit after EOF (default 10)\n");
+    exit(1);
+}
+
+int main(int argc, char **argv)
+{
+    struct trace_t traces[MAXTRACES];
+    int c, i, status, ntraces, next = 0, running = 0, failed = 0;
+    int njobs = sysconf(_SC_NPROCESSORS_ONLN);
+    char *results[] = {"ok", "FAIL", "TIMEOUT", "ERROR"};
+    double start = now();
+    pid_t pid;
+
+    while ((c = getopt(argc, argv, "hgvs:a:j:T:")) != EOF) {
+        switch (c) {
+        case 'g': generate = 1; break;
+        case 'v': verbose = 1; break;
+        case 's': shell = optarg; break;
+        case 'a': shellargs = optarg; break;
+        case 'j': njobs = atoi(optarg); break;
+        case 'T': timeout = atoi(optarg); break;
+        default:  usage(argv[0]);
+        }
+    }
+    if ((ntraces = argc - optind) == 0 || ntraces > MAXTRACES)
+        usage(argv[0]);
+    if (njobs < 1)
+        njobs = 1;
+    if (verbose)
+        njobs = 1;  /* keep the outputs readable */
+    Signal(SIGPIPE, SIG_IGN);   /* a shell may exit before its trace ends */
+    for (i = 0; i < ntraces; i++) {
+        traces[i].path = argv[optind + i];
+        traces[i].pid = 0;
+    }
+
+    /* run up to njobs traces at a time, each in its own worker */
+    while (next < ntraces || running > 0) {
+        if (next < ntraces && running < njobs) {
+            fflush(stdout);
+            traces[next].start = now();
+            if ((traces[next].pid = Fork()) == 0) {
+                status = runtrace(traces[next].path);
+                fflush(stdout);
+                _exit(status);
+            }
+            next++;
+            running++;
+            continue;
+        }
+
+        pid = Wait(&status);
+        for (i = 0; i < next && traces[i].pid != pid; i++)
+            ;
+        if (i == next)
+            continue;   /* not one of our workers */
+        running--;
+        traces[i].secs = now() - traces[i].start;
+        traces[i].result = WIFEXITED(status) ? WEXITSTATUS(status) : ERROR;
+        if (traces[i].result > ERROR)
+            traces[i].result = ERROR;
+        if (traces[i].result != PASS)
+            failed++;
+        printf("%-24s %-7s %8.3fs\n", traces[i].path, results[traces[i].result], traces[i].secs);
+    }
+
+    printf("%d/%d traces passed in %.3fs\n", ntraces - failed, ntraces, now() - start);
+    exit(failed ? 1 : 0);
+}
@@ -0,0 +1,44 @@
+/* 
+ * stamp.h - Kill-timestamp probes shared by myint and mystop
+ * 
+ * A probe file gets one "<pid> <ns>" line per signal a program sends
+ * itself, with the CLOCK_MONOTONIC time just before the kill. The
+ * file may be a FIFO, so a harness can time how long the shell takes
+ * to report the job.
+ */
+#ifndef __STAMP_H__
+#define __STAMP_H__
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+#include <sys/types.h>
+
+/* openstamp - Open the probe file for appending, or exit with an error */
+static int openstamp(char *file)
+{
+    int fd;
+
+    if ((fd = open(file, O_WRONLY | O_APPEND | O_CREAT, 0644)) < 0) {
+	perror(file);
+	exit(1);
+    }
+    return fd;
+}
+
+/* stamp - Append "<pid> <now in ns>" to the file open on fd */
+static void stamp(int fd, pid_t pid)
+{
+    char buf[64];
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    sprintf(buf, "%d %lld\n", (int)pid, ts.tv_sec * 1000000000LL + ts.tv_nsec);
+    if (write(fd, buf, strlen(buf)) < 0)
+	fprintf(stderr, "write (stamp) error\n");
+}
+
+#endif /* __STAMP_H__ */
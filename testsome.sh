@@ -1,16 +1,8 @@
-make test01
-make rtest01
-make test02
-make rtest02
-make test03
-make rtest03
-make test04
-make rtest04
-make test05
-make rtest05
-make test06
-make rtest06
-make test07
-make rtest07
-make test08
-make rtest08
\ No newline at end of file
+#!/bin/sh
+#
+# testsome.sh - Run the regression traces against ./tsh
+#
+# Extra arguments are passed to sdriver, e.g. "./testsome.sh -j 4".
+#
+make -s sdriver tsh myspin || exit 1
+exec ./sdriver "$@" traces/trace0[1-8].txt
@@ -0,0 +1,275 @@
+/*
+ * tpbench.c - Work-stealing thread pool against a mutex and condvar queue
+ *
+ * usage: tpbench [-h] [-n <tasks>] [-s <samples>] [-w <workers>]
+ * Runs three loads on the thread pool of csapp.c and on a plain pool
+ * of workers that share one queue under a mutex and a condition
+ * variable, with <workers> workers (default: runs with 1, 4 and 16):
+ *     flat     the main thread submits <tasks> tiny tasks and waits
+ *     tree     a task splits in two, down to about <tasks> tasks in all,
+ *              so nearly every task is submitted by a worker
+ *     latency  the main thread submits <samples> tasks 50 us apart
+ * and prints tasks per second for the first two and, for the last,
+ * the time from submit until a task starts, at the median, the 99th
+ * and the 99.9th percentile.
+ */
+#include "csapp.h"
+
+#define MAXWORKERS 64
+#define SPIN 100            /* work in a tiny task */
+#define PACE_NS 50000       /* between latency samples */
+
+int ntasks = 1 << 20;       /* tasks of the flat and tree loads */
+int nsamples = 20000;       /* tasks of the latency load */
+int depth;                  /* of the tree load, from ntasks */
+double *submitted;          /* latency load: submit time of each task */
+double *latency;            /* latency load: wait of each task */
+
+/* now - Return the monotonic clock in seconds */
+double now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/*
+ * The baseline: one queue of tasks, a mutex and two condition
+ * variables, one for the workers and one for mq_wait.
+ */
+struct {
+    pthread_mutex_t lock;
+    pthread_cond_t ready;   /* there are tasks, or we are stopping */
+    pthread_cond_t done;    /* pending dropped to 0 */
+    tp_task_t *tasks;
+    long head, count, size;
+    long pending;           /* submitted, not yet finished */
+    int stopping;
+    int nworkers;
+    pthread_t tids[MAXWORKERS];
+} mq;
+
+void mq_submit(tp_func_t func, void *arg)
+{
+    tp_task_t *tasks;
+    long i;
+
+    pthread_mutex_lock(&mq.lock);
+    if (mq.count == mq.size) {
+        tasks = Malloc(2 * mq.size * sizeof(tp_task_t));
+        for (i = 0; i < mq.count; i++)
+            tasks[i] = mq.tasks[(mq.head + i) % mq.size];
+        Free(mq.tasks);
+        mq.tasks = tasks;
+        mq.head = 0;
+        mq.size *= 2;
+    }
+    mq.tasks[(mq.head + mq.count) % mq.size].func = func;
+    mq.tasks[(mq.head + mq.count) % mq.size].arg = arg;
+    mq.count++;
+    mq.pending++;
+    pthread_cond_signal(&mq.ready);
+    pthread_mutex_unlock(&mq.lock);
+}
+
+void *mq_worker(void *vargp)
+{
+    tp_task_t task;
+
+    pthread_mutex_lock(&mq.lock);
+    for (;;) {
+        while (mq.count == 0 && !mq.stopping)
+            pthread_cond_wait(&mq.ready, &mq.lock);
+        if (mq.count == 0)
+            break;
+        task = mq.tasks[mq.head];
+        mq.head = (mq.head + 1) % mq.size;
+        mq.count--;
+        pthread_mutex_unlock(&mq.lock);
+        task.func(task.arg);
+        pthread_mutex_lock(&mq.lock);
+        if (--mq.pending == 0)
+            pthread_cond_broadcast(&mq.done);
+    }
+    pthread_mutex_unlock(&mq.lock);
+    return NULL;
+}
+
+void mq_init(int nworkers)
+{
+    int i;
+
+    pthread_mutex_init(&mq.lock, NULL);
+    pthread_cond_init(&mq.ready, NULL);
+    pthread_cond_init(&mq.done, NULL);
+    mq.size = 1024;
+    mq.tasks = Malloc(mq.size * sizeof(tp_task_t));
+    mq.head = mq.count = mq.pending = 0;
+    mq.stopping = 0;
+    mq.nworkers = nworkers;
+    for (i = 0; i < nworkers; i++)
+        Pthread_create(&mq.tids[i], NULL, mq_worker, NULL);
+}
+
+void mq_wait(void)
+{
+    pthread_mutex_lock(&mq.lock);
+    while (mq.pending > 0)
+        pthread_cond_wait(&mq.done, &mq.lock);
+    pthread_mutex_unlock(&mq.lock);
+}
+
+void mq_free(void)
+{
+    int i;
+
+    mq_wait();
+    pthread_mutex_lock(&mq.lock);
+    mq.stopping = 1;
+    pthread_cond_broadcast(&mq.ready);
+    pthread_mutex_unlock(&mq.lock);
+    for (i = 0; i < mq.nworkers; i++)
+        Pthread_join(mq.tids[i], NULL);
+    Free(mq.tasks);
+}
+
+/* The pool under test, behind the same four calls */
+tp_pool_t pool;
+
+void tp_init_(int nworkers) { Tp_init(&pool, nworkers); }
+void tp_submit_(tp_func_t func, void *arg) { Tp_submit(&pool, func, arg); }
+void tp_wait_(void) { tp_wait(&pool); }
+void tp_free_(void) { tp_free(&pool); }
+
+struct impl_t {
+    char *name;
+    void (*init)(int nworkers);
+    void (*submit)(tp_func_t func, void *arg);
+    void (*wait)(void);
+    void (*free)(void);
+} impls[] = {
+    {"mutex", mq_init, mq_submit, mq_wait, mq_free},
+    {"stealing", tp_init_, tp_submit_, tp_wait_, tp_free_},
+};
+struct impl_t *impl;        /* of the current run */
+
+/* The tasks */
+void spin(void)
+{
+    volatile int i;
+
+    for (i = 0; i < SPIN; i++)
+        ;
+}
+
+void flat(void *arg)
+{
+    spin();
+}
+
+void tree(void *arg)
+{
+    long d = (long)arg;
+
+    spin();
+    if (d < depth) {
+        impl->submit(tree, (void *)(d + 1));
+        impl->submit(tree, (void *)(d + 1));
+    }
+}
+
+void sample(void *arg)
+{
+    long i = (long)arg;
+
+    latency[i] = now() - submitted[i];
+    spin();
+}
+
+int cmpdouble(const void *a, const void *b)
+{
+    double x = *(double *)a, y = *(double *)b;
+
+    return x < y ? -1 : x > y;
+}
+
+/* run - Run the three loads with nworkers workers of one kind */
+void run(struct impl_t *which, int nworkers)
+{
+    struct timespec pace = {0, PACE_NS};
+    double start, flatsecs, treesecs;
+    long i;
+
+    impl = which;
+    impl->init(nworkers);
+
+    start = now();
+    for (i = 0; i < ntasks; i++)
+        impl->submit(flat, NULL);
+    impl->wait();
+    flatsecs = now() - start;
+
+    start = now();
+    impl->submit(tree, (void *)0L);
+    impl->wait();
+    treesecs = now() - start;
+
+    for (i = 0; i < nsamples; i++) {
+        submitted[i] = now();
+        impl->submit(sample, (void *)i);
+        nanosleep(&pace, NULL);
+    }
+    impl->wait();
+    impl->free();
+
+    qsort(latency, nsamples, sizeof(double), cmpdouble);
+    printf("%-8d %-9s %12.0f %12.0f %9.1f %9.1f %9.1f\n", nworkers, impl->name,
+           ntasks / flatsecs, ((2L << depth) - 1) / treesecs,
+           latency[nsamples / 2] * 1e6, latency[nsamples * 99 / 100] * 1e6,
+           latency[nsamples * 999 / 1000] * 1e6);
+}
+
+void usage(char *prog)
+{
+    printf("Usage: %s [-h] [-n <tasks>] [-s <samples>] [-w <workers>]\n", prog);
+    printf("   -h            print this message\n");
+    printf("   -n <tasks>    tasks of the flat and tree loads (default %d)\n", 1 << 20);
+    printf("   -s <samples>  tasks of the latency load (default 20000)\n");
+    printf("   -w <workers>  only run with this many workers\n");
+    exit(1);
+}
+
+int main(int argc, char **argv)
+{
+    int c, i, nworkers = 0;
+    int sizes[] = {1, 4, 16};
+
+    while ((c = getopt(argc, argv, "hn:s:w:")) != EOF) {
+        switch (c) {
+        case 'n': ntasks = atoi(optarg); break;
+        case 's': nsamples = atoi(optarg); break;
+        case 'w': nworkers = atoi(optarg); break;
+        default:  usage(argv[0]);
+        }
+    }
+    if (optind != argc || ntasks < 2 || nsamples < 1 || nworkers < 0 ||
+        nworkers > MAXWORKERS)
+        usage(argv[0]);
+
+    /* a full binary tree of depth d has 2^(d+1) - 1 tasks */
+    for (depth = 0; (2L << (depth + 1)) - 1 <= ntasks; depth++)
+        ;
+    submitted = Malloc(nsamples * sizeof(double));
+    latency = Malloc(nsamples * sizeof(double));
+
+    printf("%-8s %-9s %12s %12s %9s %9s %9s\n", "workers", "pool", "flat/s",
+           "tree/s", "p50 us", "p99 us", "p999 us");
+    for (i = 0; i < 3; i++) {
+        if (nworkers > 0 && i > 0)
+            break;
+        run(&impls[0], nworkers > 0 ? nworkers : sizes[i]);
+        run(&impls[1], nworkers > 0 ? nworkers : sizes[i]);
+    }
+    exit(0);
+}
@@ -0,0 +1,45 @@
+/* 
+ * trace.h - Binary event trace format shared by tsh and tshtrace
+ * 
+ * A trace file is a header followed by a ring of fixed-size records.
+ * Writers claim a slot by incrementing head, fill in the record and
+ * then store its sequence number, so a reader can tell a complete
+ * record from a slot that is still being written or was overwritten.
+ */
+#ifndef __TRACE_H__
+#define __TRACE_H__
+
+#define TRACEMAGIC   0x74736874  /* "tsht" */
+#define TRACEVERSION 1
+#define TRACERECS    65536       /* records in the ring (power of two) */
+
+/* Trace events */
+#define TR_PARSE_BEGIN 1  /* parseline started */
+#define TR_PARSE_END   2  /* parseline done: arg0 = bg, or -1 for a blank line */
+#define TR_FORK        3  /* fork returned in the shell: arg0 = child pid */
+#define TR_SETPGID     4  /* child called setpgid: arg0 = result */
+#define TR_EXEC        5  /* child is about to call execve */
+#define TR_SIGNAL      6  /* signal forwarded: arg0 = pgid, arg1 = signal */
+#define TR_REAP        7  /* waitpid returned: arg0 = pid, arg1 = status */
+#define TR_STATE       8  /* job state change: arg0 = pid, arg1 = old, arg2 = new */
+#define TR_WAIT_BEGIN  9  /* waitfg started: arg0 = pid */
+#define TR_WAIT_END   10  /* waitfg returned: arg0 = pid */
+
+struct tracehdr_t {             /* The trace file header */
+    unsigned int magic;         /* TRACEMAGIC */
+    unsigned int version;       /* TRACEVERSION */
+    unsigned int recsize;       /* sizeof(struct tracerec_t) */
+    unsigned int nrecs;         /* records in the ring */
+    unsigned long long head;    /* number of records ever claimed */
+};
+
+struct tracerec_t {             /* One trace record (32 bytes) */
+    unsigned long long ns;      /* CLOCK_MONOTONIC timestamp */
+    unsigned int seq;           /* low bits of slot number + 1, 0 if unwritten */
+    int pid;                    /* process that recorded the event */
+    unsigned short event;       /* TR_* */
+    unsigned short pad;
+    int arg[3];                 /* event arguments */
+};
+
+#endif /* __TRACE_H__ */
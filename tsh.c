@@ -14,13 +14,35 @@
 #include <signal.h>
 #include <sys/types.h>
 #include <sys/wait.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <fcntl.h>
 #include <errno.h>
+#include <time.h>
+#include <pthread.h>
+#include <linux/perf_event.h>
+#include "trace.h"
 
 /* Misc manifest constants */
 #define MAXLINE    1024   /* max line size */
 #define MAXARGS     128   /* max args on a command line */
+#ifndef MAXJOBS               /* jobbench builds the job list at other sizes */
 #define MAXJOBS      16   /* max jobs at any point in time */
+#endif
 #define MAXJID    1<<16   /* max job ID */
+#define STATUSMAGIC 0x74736873 /* "tshs", marks an initialized status page */
+#define STATUSVERSION 2        /* layout of the page; 2 added the perf fields */
+#define STATUSTRIES 1000000    /* seqlock read attempts before giving up */
+#define HISTMIN      10   /* values below 2^HISTMIN ns share bucket 0 */
+#define HISTMAX      36   /* largest power of two exported (~69 s) */
+#define HISTSUB       4   /* sub-buckets per power of two */
+#define HISTBUCKETS  (1 + (64-HISTMIN)*HISTSUB)
+#define METRICSBUF  16384 /* max size of a metrics report */
+#define NPERF         5   /* perf_event counters per perfstat job */
 
 /* Job states */
 #define UNDEF 0 /* undefined */
@@ -49,10 +71,80 @@ struct job_t {              /* The job struct */
     pid_t pid;              /* job PID */
     int jid;                /* job ID [1, 2, ...] */
     int state;              /* UNDEF, BG, FG, or ST */
+    int perf;               /* report counters at reap (perfstat) */
+    int perffd[NPERF];      /* perf_event fds, -1 if not counted */
+    int perfsw;             /* mask of counters that fell back to software */
     char cmdline[MAXLINE];  /* command line */
 };
 
+struct perfctr_t {          /* A perfstat counter and its fallback */
+    char *name;             /* name in the report */
+    int type;               /* PERF_TYPE_* */
+    int config;             /* PERF_COUNT_* */
+    char *swname;           /* software fallback name, NULL if none */
+    int swconfig;           /* PERF_COUNT_SW_* of the fallback */
+};
+
+struct perfctr_t perfctrs[NPERF] = {
+    {"task-clock", PERF_TYPE_SOFTWARE, PERF_COUNT_SW_TASK_CLOCK, NULL, 0},
+    {"context-switches", PERF_TYPE_SOFTWARE, PERF_COUNT_SW_CONTEXT_SWITCHES, NULL, 0},
+    {"page-faults", PERF_TYPE_SOFTWARE, PERF_COUNT_SW_PAGE_FAULTS, NULL, 0},
+    {"cycles", PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES,
+     "cpu-clock", PERF_COUNT_SW_CPU_CLOCK},
+    {"instructions", PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS, NULL, 0},
+};
+
 struct job_t jobs[MAXJOBS]; /* The job list */
+
+/*
+ * The status page mirrors the job list in a shared file mapping so
+ * that other processes can read it without talking to the shell.
+ * The shell is the only writer: it makes seq odd, rewrites the
+ * changed record and makes seq even again. A reader copies the page
+ * and retries until it sees the same even seq before and after.
+ */
+struct status_t {               /* The published status page */
+    unsigned int magic;         /* STATUSMAGIC once initialized */
+    unsigned int version;       /* STATUSVERSION */
+    unsigned int jobsize;       /* sizeof(struct job_t) */
+    unsigned int seq;           /* seqlock sequence number */
+    pid_t shellpid;             /* PID of the publishing shell */
+    int maxjobs;                /* number of job records */
+    struct job_t jobs[MAXJOBS]; /* copy of the job list */
+};
+
+struct status_t *status = NULL; /* mapped status page, NULL if disabled */
+char statusfile[MAXLINE];       /* path of the status page */
+
+/*
+ * Latency histograms in nanoseconds. Each power of two above 2^HISTMIN
+ * is split into HISTSUB linear sub-buckets, so recording is a clz and
+ * a few atomic adds and is safe from signal handlers.
+ */
+struct hist_t {                 /* A log-bucketed latency histogram */
+    char *name;                 /* metric name */
+    char *help;                 /* metric description */
+    unsigned long long count;   /* number of samples */
+    unsigned long long sum;     /* sum of samples (ns) */
+    unsigned long long buckets[HISTBUCKETS]; /* samples per bucket */
+};
+
+struct hist_t spawnhist = {"tsh_spawn_latency_seconds",
+    "Time from fork to the job being added to the job list"};
+struct hist_t waithist = {"tsh_wait_latency_seconds",
+    "Time from the foreground job being reaped or stopped to waitfg returning"};
+struct hist_t sighist = {"tsh_signal_forward_latency_seconds",
+    "Time to forward ctrl-c or ctrl-z to the foreground process group"};
+
+unsigned long long nspawned = 0; /* jobs started */
+unsigned long long nreaped = 0;  /* children reaped */
+unsigned long long nforwarded = 0; /* signals forwarded to a job */
+long long fgdone = 0;           /* when the FG job was reaped or stopped (atomic) */
+char metricsfile[MAXLINE];      /* path of the metrics socket */
+int metricsfd = -1;             /* listening metrics socket, -1 if disabled */
+
+struct tracehdr_t *tracehdr = NULL; /* mapped trace file, NULL if disabled */
+struct tracerec_t *tracering;   /* records following the trace header */
 /* End global variables */
 
 /* Function prototypes */
@@ -84,6 +176,31 @@ void listjobs(struct job_t *jobs);
 void listbgjobs(struct job_t *jobs);
 void listjob(struct job_t *job);
 
+void rundir(char *dir);
+void initstatus(void);
+void fillstatus(void);
+void removestatus(void);
+void publishjob(struct job_t *job);
+int snapstatus(struct status_t *page, struct status_t *snap);
+int showstatus(pid_t pid);
+
+long long nowns(void);
+int histbucket(unsigned long long ns);
+void histrecord(struct hist_t *hist, long long ns);
+int formathist(char *buf, int size, struct hist_t *hist);
+int formatmetrics(char *buf, int size, struct job_t *jobs);
+void initmetrics(void);
+void removemetrics(void);
+void *servemetrics(void *vargp);
+
+void inittrace(char *filename);
+void traceevent(int event, int arg0, int arg1, int arg2);
+
+int perfopen(int type, int config, pid_t pid);
+void attachperf(struct job_t *job);
+void reportperf(struct job_t *job, struct rusage *ru);
+void closeperf(struct job_t *job);
+
 void usage(void);
 void unix_error(char *msg);
 void app_error(char *msg);
@@ -98,19 +215,31 @@ int Sigaddset(sigset_t *set, int signum);
 int Sigemptyset(sigset_t *set);
 int Sigfillset(sigset_t *set);
 int Sigprocmask(int how, const sigset_t *set, sigset_t *oldset);
+void *Mmap(void *addr, size_t len, int prot, int flags, int fd, off_t offset);
 
 int main(int argc, char **argv) 
 {
     char c;
     char cmdline[MAXLINE];
     int emit_prompt = 1; /* emit prompt (default) */
+    int publish = 0;     /* publish the job list (-s) */
+    int metrics = 0;     /* serve metrics on a local socket (-m) */
+    char *tracefile = NULL; /* record a binary event trace (-t) */
 
     /* Redirect stderr to stdout (so that driver will get all output
      * on the pipe connected to stdout) */
     dup2(1, 2);
 
+    /* Read the status page of another shell instead of running one */
+    if (argc == 3 && !strcmp(argv[1], "--status")) {
+        if (!isnumber(argv[2])) {
+            usage();
+        }
+        exit(showstatus(atoi(argv[2])));
+    }
+
     /* Parse the command line */
-    while ((c = getopt(argc, argv, "hvp")) != EOF) {
+    while ((c = getopt(argc, argv, "hvpsmt:")) != EOF) {
         switch (c) {
             case 'h':             /* print help message */
                 usage();
@@ -121,6 +250,15 @@ int main(int argc, char **argv)
             case 'p':             /* don't print a prompt */
                 emit_prompt = 0;  /* handy for automatic testing */
     	        break;
+            case 's':             /* publish the job list */
+                publish = 1;
+    	        break;
+            case 'm':             /* serve metrics on a local socket */
+                metrics = 1;
+    	        break;
+            case 't':             /* record a binary event trace */
+                tracefile = optarg;
+    	        break;
             default:
                 usage();
     	}
@@ -138,6 +276,15 @@ int main(int argc, char **argv)
 
     /* Initialize the job list */
     initjobs(jobs);
+    if (publish) {
+        initstatus();
+    }
+    if (metrics) {
+        initmetrics();
+    }
+    if (tracefile) {
+        inittrace(tracefile);
+    }
 
     /* Execute the shell's read/eval loop */
     while (1) {
@@ -176,51 +323,90 @@ int main(int argc, char **argv)
  * each child process must have a unique process group ID so that our
  * background children don't receive SIGINT (SIGTSTP) from the kernel
  * when we type ctrl-c (ctrl-z) at the keyboard.  
+ *
+ * A command line starting with perfstat runs the rest of the line as
+ * a job with perf_event counters attached; they are reported together
+ * with the job's rusage when it is reaped.
 */
 void eval(char *cmdline) 
 {
     /* allocate storage for argv array */
     char *argv[MAXARGS];
-    int bg;
+    char **cmdargv = argv;
+    int bg, perf, rc;
+    int perfpipe[2];
     pid_t pid;
+    long long start;
     sigset_t mask_all, mask_sigchld, prev_one;
 
     Sigfillset(&mask_all);
     Sigemptyset(&mask_sigchld);
     Sigaddset(&mask_sigchld, SIGCHLD);
 
+    traceevent(TR_PARSE_BEGIN, 0, 0, 0);
     bg = parseline(cmdline, argv);
+    traceevent(TR_PARSE_END, bg, 0, 0);
     
     /* return on empty command */
     if (bg == -1) {
         return; 
     }
     
+    /* perfstat runs the rest of the line as a counted job */
+    if ((perf = !strcmp(argv[0], "perfstat")) != 0) {
+        cmdargv = &argv[1];
+        if (cmdargv[0] == NULL) {
+            printf("perfstat command requires a command argument\n");
+            return;
+        }
+        /* the child waits for EOF on this pipe until counters are open */
+        if (pipe(perfpipe) < 0) {
+            unix_error("pipe failed");
+        }
+    }
+    
     /* executes builtin_cmd directly in the logical test if the command
     is built-in. If not, executes the non-built-in command */
-    if (!builtin_cmd(argv)) {
+    if (perf || !builtin_cmd(argv)) {
+        /* Block SIGCHLD signals so that the child cannot be reaped
+         * before it has been added to the job list */
+        Sigprocmask(SIG_BLOCK, &mask_sigchld, &prev_one);
+
+        start = nowns();
         pid = fork();
 
         if (pid < 0) {
             unix_error("fork failed.");
             exit(1);
         }
-
-        /* Block SIGCHLD signals */
-        Sigprocmask(SIG_BLOCK, &mask_sigchld, &prev_one);
+        if (pid > 0) {
+            traceevent(TR_FORK, pid, 0, 0);
+        }
 
         /* child */
         if (pid == 0) {
 
             /* put child in new processgroup with pgid = pid[child] */
-            if(setpgid(0, 0) < 0) {
+            rc = setpgid(0, 0);
+            traceevent(TR_SETPGID, rc, 0, 0);
+            if (rc < 0) {
                 unix_error("setpgid failed");
             }
 
+            if (perf) {
+                char c;
+                close(perfpipe[1]);
+                while (read(perfpipe[0], &c, 1) < 0 && errno == EINTR) {
+                    ;
+                }
+                close(perfpipe[0]);
+            }
+
             /* Unblock SIGCHLD */
             Sigprocmask(SIG_SETMASK, &prev_one, NULL);
             
-            if (execve(argv[0], argv, environ) < 0) {
+            traceevent(TR_EXEC, 0, 0, 0);
+            if (execve(cmdargv[0], cmdargv, environ) < 0) {
                 unix_error("Command not found.");
                 exit(0);
             }
@@ -229,6 +415,13 @@ void eval(char *cmdline)
         /* parent */
         Sigprocmask(SIG_BLOCK, &mask_all, NULL);
         addjob(jobs, pid, bg+1, cmdline);
+        if (perf) {
+            attachperf(getjobpid(jobs, pid));
+            close(perfpipe[0]);
+            close(perfpipe[1]);
+        }
+        histrecord(&spawnhist, nowns() - start);
+        __atomic_fetch_add(&nspawned, 1, __ATOMIC_RELAXED);
         if (bg) {
             listjob(getjobpid(jobs, pid));
         }
@@ -313,7 +506,7 @@ int parseline(const char *cmdline, char **argv)
 
 /* 
  * builtin_cmd - If the user has typed a built-in command then execute it immediately.
- * supported cmds: bg, fg, quit, jobs  
+ * supported cmds: bg, fg, quit, jobs, stats
  * returns 0 if the command is not built-in
  */
 int builtin_cmd(char **argv) 
@@ -331,6 +524,12 @@ int builtin_cmd(char **argv)
         listbgjobs(jobs);
         fflush(stdout);
         return 1;
+    } else if (!strcmp(argv[0], "stats")) {
+        char buf[METRICSBUF];
+        formatmetrics(buf, sizeof(buf), jobs);
+        printf("%s", buf);
+        fflush(stdout);
+        return 1;
     } else {
         return 0;
     }
@@ -391,12 +590,15 @@ void do_bgfg(char **argv)
     /* we want to mask SIGCHLD so that it isn't caught before state is adapted */
     Sigprocmask(SIG_BLOCK, &mask_sigchld, &prev_one);
     Kill(-(job->pid), SIGCONT);
+    traceevent(TR_SIGNAL, job->pid, SIGCONT, 0);
+    traceevent(TR_STATE, job->pid, job->state, isbg ? BG : FG);
     if (isbg) {
         listjob(job);
         job->state = BG;
     } else {
         job->state = FG;
     }
+    publishjob(job);
     Sigprocmask(SIG_SETMASK, &prev_one, NULL);
 
     if (!isbg) {
@@ -411,6 +613,10 @@ void do_bgfg(char **argv)
  */
 void waitfg(pid_t pid)
 {
+    long long done;
+
+    traceevent(TR_WAIT_BEGIN, pid, 0, 0);
+
     /* sleep indefinitely untill FG process is no longer the FG process */
     while(1) {
         sleep(1);
@@ -418,6 +624,10 @@ void waitfg(pid_t pid)
             break;
         }
     }
+    if ((done = __atomic_exchange_n(&fgdone, 0, __ATOMIC_RELAXED)) != 0) {
+        histrecord(&waithist, nowns() - done);
+    }
+    traceevent(TR_WAIT_END, pid, 0, 0);
     return;
 }
 
@@ -437,11 +647,21 @@ void sigchld_handler(int sig)
     int olderrno = errno;
     int status;
     sigset_t mask_all, prev_all;
+    struct rusage ru;
+    struct job_t *job;
     pid_t pid;
 
     Sigfillset(&mask_all);
-    while((pid = waitpid(-1, &status, WNOHANG | WUNTRACED)) > 0) {
-        
+    while((pid = wait4(-1, &status, WNOHANG | WUNTRACED, &ru)) > 0) {
+        __atomic_fetch_add(&nreaped, 1, __ATOMIC_RELAXED);
+        traceevent(TR_REAP, pid, status, 0);
+        if (pid == fgpid(jobs)) {
+            __atomic_store_n(&fgdone, nowns(), __ATOMIC_RELAXED);
+        }
+        if (!WIFSTOPPED(status) && (job = getjobpid(jobs, pid)) != NULL && job->perf) {
+            reportperf(job, &ru);
+        }
+
         /* If we exited normally, we can safely delete the job */
         if (WIFEXITED(status)) {
             Sigprocmask(SIG_BLOCK, &mask_all, &prev_all);
@@ -449,8 +669,16 @@ void sigchld_handler(int sig)
             Sigprocmask(SIG_SETMASK, &prev_all, NULL);
         }
 
+        /* A stopped job stays in the list, whoever stopped it */
         if (WIFSTOPPED(status)) {
             printf("Job [%d] (%d) stopped by signal %d\n", pid2jid(pid), pid, WSTOPSIG(status));
+            Sigprocmask(SIG_BLOCK, &mask_all, &prev_all);
+            if ((job = getjobpid(jobs, pid)) != NULL) {
+                traceevent(TR_STATE, pid, job->state, ST);
+                job->state = ST;
+                publishjob(job);
+            }
+            Sigprocmask(SIG_SETMASK, &prev_all, NULL);
         }
 
         if (WIFSIGNALED(status)) {
@@ -473,6 +701,7 @@ void sigchld_handler(int sig)
 void sigint_handler(int sig) 
 {
     int olderrno = errno;
+    long long start = nowns();
     pid_t pid = fgpid(jobs);
     
     if (pid == 0) {
@@ -480,6 +709,9 @@ void sigint_handler(int sig)
     }
 
     Kill(-pid, SIGINT);
+    traceevent(TR_SIGNAL, pid, SIGINT, 0);
+    histrecord(&sighist, nowns() - start);
+    __atomic_fetch_add(&nforwarded, 1, __ATOMIC_RELAXED);
     errno = olderrno;
     return;
 }
@@ -492,22 +724,18 @@ void sigint_handler(int sig)
 void sigtstp_handler(int sig) 
 {
     int olderrno = errno;
+    long long start = nowns();
     pid_t pid = fgpid(jobs);
-    sigset_t mask_all, prev_all;
-
-    Sigfillset(&mask_all);
     
     if (pid == 0) {
         return;
     }
 
+    /* the job becomes ST once sigchld_handler sees it stop */
     Kill(-pid, SIGTSTP);
-
-    /* update foreground job state to ST */
-    Sigprocmask(SIG_BLOCK, &mask_all, &prev_all);
-    struct job_t *fgjob = getjobpid(jobs, pid);
-    fgjob->state = ST;
-    Sigprocmask(SIG_SETMASK, &prev_all, NULL);
+    traceevent(TR_SIGNAL, pid, SIGTSTP, 0);
+    histrecord(&sighist, nowns() - start);
+    __atomic_fetch_add(&nforwarded, 1, __ATOMIC_RELAXED);
 
     errno = olderrno;
     return;
@@ -534,9 +762,16 @@ void sigquit_handler(int sig)
 /* clearjob - Clear the entries in a job struct */
 void clearjob(struct job_t *job) 
 {
+    int i;
+
     job->pid = 0;
     job->jid = 0;
     job->state = UNDEF;
+    job->perf = 0;
+    for (i = 0; i < NPERF; i++) {
+        job->perffd[i] = -1;
+    }
+    job->perfsw = 0;
     job->cmdline[0] = '\0';
 }
 
@@ -577,6 +812,7 @@ int addjob(struct job_t *jobs, pid_t pid, int state, char *cmdline)
     	if (jobs[i].pid == 0) {
     	    jobs[i].pid = pid;
     	    jobs[i].state = state;
+    	    traceevent(TR_STATE, pid, UNDEF, state);
     	    jobs[i].jid = nextjid++;
     	    if (nextjid > MAXJOBS) {
                 nextjid = 1;
@@ -585,6 +821,7 @@ int addjob(struct job_t *jobs, pid_t pid, int state, char *cmdline)
       	    if(verbose){
     	        printf("Added job [%d] %d %s\n", jobs[i].jid, jobs[i].pid, jobs[i].cmdline);
             }
+            publishjob(&jobs[i]);
             return 1;
     	}
     }
@@ -603,7 +840,10 @@ int deletejob(struct job_t *jobs, pid_t pid)
 
     for (i = 0; i < MAXJOBS; i++) {
     	if (jobs[i].pid == pid) {
+    	    traceevent(TR_STATE, pid, jobs[i].state, UNDEF);
+    	    closeperf(&jobs[i]);
     	    clearjob(&jobs[i]);
+    	    publishjob(&jobs[i]);
     	    nextjid = maxjid(jobs)+1;
     	    return 1;
     	}
@@ -734,6 +974,561 @@ void listbgjobs(struct job_t *jobs)
  * end job list helper routines
  ******************************/
 
+/********************************************
+ * Helper routines for the shared status page
+ ********************************************/
+
+/* 
+ * rundir - Put in dir the directory for this user's status pages and
+ *    metrics sockets, $XDG_RUNTIME_DIR/tsh or else /tmp/tsh-<uid>,
+ *    creating it if need be. Exits unless it is a real directory that
+ *    we own and nobody else can get into, so that the names in it
+ *    cannot be planted or read by other users.
+ */
+void rundir(char *dir)
+{
+    struct stat st;
+    char *base = getenv("XDG_RUNTIME_DIR");
+
+    if (base != NULL && base[0] == '/' && strlen(base) < 64) {
+        sprintf(dir, "%s/tsh", base);
+    }
+    else {
+        sprintf(dir, "/tmp/tsh-%d", (int)getuid());
+    }
+    if (mkdir(dir, 0700) < 0 && errno != EEXIST) {
+        unix_error("mkdir run directory failed");
+    }
+    if (lstat(dir, &st) < 0) {
+        unix_error("lstat run directory failed");
+    }
+    if (!S_ISDIR(st.st_mode) || st.st_uid != getuid() || (st.st_mode & 077)) {
+        printf("%s: not a private directory\n", dir);
+        exit(1);
+    }
+}
+
+/* 
+ * initstatus - Create and map the status page of this shell. A page
+ *    left by an earlier shell with the same PID is replaced, never
+ *    opened, and the page is only readable by us.
+ */
+void initstatus(void)
+{
+    char dir[MAXLINE / 2];
+    int fd;
+
+    rundir(dir);
+    snprintf(statusfile, sizeof(statusfile), "%s/%d.status", dir, getpid());
+    unlink(statusfile);
+    if ((fd = open(statusfile, O_RDWR | O_CREAT | O_EXCL | O_NOFOLLOW, 0600)) < 0) {
+        unix_error("open status page failed");
+    }
+    if (ftruncate(fd, sizeof(struct status_t)) < 0) {
+        unix_error("ftruncate status page failed");
+    }
+    status = Mmap(NULL, sizeof(struct status_t), PROT_READ | PROT_WRITE,
+                  MAP_SHARED, fd, 0);
+    close(fd);
+    fillstatus();
+    atexit(removestatus);
+}
+
+/* fillstatus - Publish the whole job list on a new status page */
+void fillstatus(void)
+{
+    status->version = STATUSVERSION;
+    status->jobsize = sizeof(struct job_t);
+    status->seq = 0;
+    status->shellpid = getpid();
+    status->maxjobs = MAXJOBS;
+    memcpy(status->jobs, jobs, sizeof(jobs));
+    __atomic_store_n(&status->magic, STATUSMAGIC, __ATOMIC_RELEASE);
+}
+
+/* removestatus - Unlink the status page when the shell exits */
+void removestatus(void)
+{
+    if (status != NULL && status->shellpid == getpid() && statusfile[0] != '\0') {
+        unlink(statusfile);
+    }
+}
+
+/* 
+ * publishjob - Copy one job record to the status page. All signals are
+ *    blocked so that a handler cannot start a second write while this
+ *    one holds the seqlock.
+ */
+void publishjob(struct job_t *job)
+{
+    sigset_t mask_all, prev_all;
+    unsigned int seq;
+
+    if (status == NULL) {
+        return;
+    }
+
+    Sigfillset(&mask_all);
+    Sigprocmask(SIG_BLOCK, &mask_all, &prev_all);
+
+    seq = status->seq;
+    __atomic_store_n(&status->seq, seq + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    memcpy(&status->jobs[job - jobs], job, sizeof(struct job_t));
+    __atomic_store_n(&status->seq, seq + 2, __ATOMIC_RELEASE);
+
+    Sigprocmask(SIG_SETMASK, &prev_all, NULL);
+}
+
+/* 
+ * showstatus - Print the job list published by the shell with PID=pid.
+ *    Returns the exit status for tsh --status.
+ */
+int showstatus(pid_t pid)
+{
+    int fd;
+    struct stat st;
+    struct status_t *page;
+    static struct status_t snap;
+    char dir[MAXLINE / 2];
+
+    rundir(dir);
+    snprintf(statusfile, sizeof(statusfile), "%s/%d.status", dir, pid);
+    if ((fd = open(statusfile, O_RDONLY | O_NOFOLLOW)) < 0) {
+        printf("%s: no status page for shell %d\n", statusfile, pid);
+        return 1;
+    }
+    if (fstat(fd, &st) < 0) {
+        unix_error("fstat status page failed");
+    }
+    if (st.st_size < sizeof(struct status_t)) {
+        printf("%s: truncated status page\n", statusfile);
+        return 1;
+    }
+    page = Mmap(NULL, sizeof(struct status_t), PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+
+    if (__atomic_load_n(&page->magic, __ATOMIC_ACQUIRE) != STATUSMAGIC) {
+        printf("%s: not a tsh status page\n", statusfile);
+        return 1;
+    }
+    if (page->version != STATUSVERSION || page->jobsize != sizeof(struct job_t) ||
+        page->maxjobs != MAXJOBS) {
+        printf("%s: status page of another tsh version\n", statusfile);
+        return 1;
+    }
+
+    if (snapstatus(page, &snap) < 0) {
+        printf("%s: status page is busy\n", statusfile);
+        return 1;
+    }
+
+    listjobs(snap.jobs);
+    return 0;
+}
+
+/* 
+ * snapstatus - Copy a consistent snapshot of a status page to snap.
+ *    Returns 0, or -1 if the page kept changing under us.
+ */
+int snapstatus(struct status_t *page, struct status_t *snap)
+{
+    unsigned int seq;
+    int i;
+
+    for (i = 0; i < STATUSTRIES; i++) {
+        seq = __atomic_load_n(&page->seq, __ATOMIC_ACQUIRE);
+        if (seq & 1) {
+            continue;
+        }
+        memcpy(snap, page, sizeof(struct status_t));
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        if (__atomic_load_n(&page->seq, __ATOMIC_RELAXED) == seq) {
+            return 0;
+        }
+    }
+    return -1;
+}
+
+
+/*************************************
+ * Helper routines for shell metrics
+ *************************************/
+
+/* nowns - Return the monotonic clock in nanoseconds */
+long long nowns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+/* histbucket - Map a latency in ns to its histogram bucket */
+int histbucket(unsigned long long ns)
+{
+    int msb;
+
+    if (ns < (1ULL << HISTMIN)) {
+        return 0;
+    }
+    msb = 63 - __builtin_clzll(ns);
+    return 1 + (msb - HISTMIN) * HISTSUB + ((ns >> (msb - 2)) & (HISTSUB - 1));
+}
+
+/* 
+ * histrecord - Add one sample to a histogram. Async-signal-safe, so
+ *    it may be called from the signal handlers.
+ */
+void histrecord(struct hist_t *hist, long long ns)
+{
+    if (ns < 0) {
+        ns = 0;
+    }
+    __atomic_fetch_add(&hist->buckets[histbucket(ns)], 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&hist->sum, ns, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&hist->count, 1, __ATOMIC_RELAXED);
+}
+
+/* 
+ * formathist - Append a histogram in Prometheus text format. Buckets
+ *    are exported at powers of two only so the label set stays fixed.
+ *    Returns the length written, which is less than size (> 0) even
+ *    when the report had to be cut short.
+ */
+int formathist(char *buf, int size, struct hist_t *hist)
+{
+    int i, msb, n = 0;
+    unsigned long long cum = 0;
+
+    n += snprintf(buf + n, size - n, "# HELP %s %s\n# TYPE %s histogram\n",
+                  hist->name, hist->help, hist->name);
+    if (n >= size) {
+        return size - 1;
+    }
+    cum = __atomic_load_n(&hist->buckets[0], __ATOMIC_RELAXED);
+    n += snprintf(buf + n, size - n, "%s_bucket{le=\"%.9f\"} %llu\n",
+                  hist->name, (1ULL << HISTMIN) / 1e9, cum);
+    for (msb = HISTMIN; msb < HISTMAX && n < size; msb++) {
+        for (i = 0; i < HISTSUB; i++) {
+            cum += __atomic_load_n(&hist->buckets[1 + (msb - HISTMIN) * HISTSUB + i],
+                                   __ATOMIC_RELAXED);
+        }
+        n += snprintf(buf + n, size - n, "%s_bucket{le=\"%.9f\"} %llu\n",
+                      hist->name, (1ULL << (msb + 1)) / 1e9, cum);
+    }
+    if (n < size) {
+        n += snprintf(buf + n, size - n,
+                      "%s_bucket{le=\"+Inf\"} %llu\n%s_sum %.9f\n%s_count %llu\n",
+                      hist->name, __atomic_load_n(&hist->count, __ATOMIC_RELAXED),
+                      hist->name, __atomic_load_n(&hist->sum, __ATOMIC_RELAXED) / 1e9,
+                      hist->name, __atomic_load_n(&hist->count, __ATOMIC_RELAXED));
+    }
+    return n < size ? n : size - 1;
+}
+
+/* 
+ * formatmetrics - Write all shell metrics, with the job counts taken
+ *    from jobs, in Prometheus text format. Returns the length written,
+ *    cut short to less than size.
+ */
+int formatmetrics(char *buf, int size, struct job_t *jobs)
+{
+    int i, n = 0, njobs = 0, nstate[ST+1] = {0};
+
+    for (i = 0; i < MAXJOBS; i++) {
+        if (jobs[i].pid != 0 && jobs[i].state <= ST) {
+            njobs++;
+            nstate[jobs[i].state]++;
+        }
+    }
+
+    n += snprintf(buf + n, size - n,
+        "# HELP tsh_jobs Jobs in the job list\n# TYPE tsh_jobs gauge\n"
+        "tsh_jobs %d\n"
+        "# HELP tsh_jobs_by_state Jobs in the job list by state\n"
+        "# TYPE tsh_jobs_by_state gauge\n"
+        "tsh_jobs_by_state{state=\"foreground\"} %d\n"
+        "tsh_jobs_by_state{state=\"running\"} %d\n"
+        "tsh_jobs_by_state{state=\"stopped\"} %d\n"
+        "# HELP tsh_max_jobs Size of the job list\n# TYPE tsh_max_jobs gauge\n"
+        "tsh_max_jobs %d\n"
+        "# HELP tsh_jobs_spawned_total Jobs started\n"
+        "# TYPE tsh_jobs_spawned_total counter\ntsh_jobs_spawned_total %llu\n"
+        "# HELP tsh_children_reaped_total Child state changes collected by waitpid\n"
+        "# TYPE tsh_children_reaped_total counter\ntsh_children_reaped_total %llu\n"
+        "# HELP tsh_signals_forwarded_total Signals forwarded to the foreground job\n"
+        "# TYPE tsh_signals_forwarded_total counter\ntsh_signals_forwarded_total %llu\n",
+        njobs, nstate[FG], nstate[BG], nstate[ST], MAXJOBS,
+        __atomic_load_n(&nspawned, __ATOMIC_RELAXED),
+        __atomic_load_n(&nreaped, __ATOMIC_RELAXED),
+        __atomic_load_n(&nforwarded, __ATOMIC_RELAXED));
+    if (n >= size) {
+        return size - 1;
+    }
+    n += formathist(buf + n, size - n, &spawnhist);
+    n += formathist(buf + n, size - n, &waithist);
+    n += formathist(buf + n, size - n, &sighist);
+    return n;
+}
+
+/* 
+ * initmetrics - Listen on <pid>.metrics in the private run directory
+ *    and start a thread that answers every connection with a metrics
+ *    report. The thread blocks all signals so that they keep going to
+ *    the main thread. It reads the job list through the seqlock of the
+ *    status page, so without -s the page is kept in private memory.
+ */
+void initmetrics(void)
+{
+    struct sockaddr_un addr;
+    sigset_t mask_all, prev_all;
+    pthread_t tid;
+    char dir[MAXLINE / 2];
+    int rc;
+
+    if (status == NULL) {
+        status = Mmap(NULL, sizeof(struct status_t), PROT_READ | PROT_WRITE,
+                      MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        fillstatus();
+    }
+
+    rundir(dir);
+    snprintf(metricsfile, sizeof(metricsfile), "%s/%d.metrics", dir, getpid());
+    if (strlen(metricsfile) >= sizeof(addr.sun_path)) {
+        app_error("metrics socket path too long");
+    }
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    memcpy(addr.sun_path, metricsfile, strlen(metricsfile) + 1);
+    unlink(metricsfile);
+
+    if ((metricsfd = socket(AF_UNIX, SOCK_STREAM, 0)) < 0) {
+        unix_error("metrics socket failed");
+    }
+    if (bind(metricsfd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+        unix_error("metrics bind failed");
+    }
+    if (listen(metricsfd, 16) < 0) {
+        unix_error("metrics listen failed");
+    }
+    atexit(removemetrics);
+
+    Sigfillset(&mask_all);
+    Sigprocmask(SIG_BLOCK, &mask_all, &prev_all);
+    if ((rc = pthread_create(&tid, NULL, servemetrics, NULL)) != 0) {
+        errno = rc;
+        unix_error("metrics thread failed");
+    }
+    Sigprocmask(SIG_SETMASK, &prev_all, NULL);
+}
+
+/* removemetrics - Unlink the metrics socket when the shell exits */
+void removemetrics(void)
+{
+    if (metricsfd >= 0) {
+        unlink(metricsfile);
+    }
+}
+
+/* servemetrics - Thread routine that serves metrics reports */
+void *servemetrics(void *vargp)
+{
+    static struct status_t snap;
+    char buf[METRICSBUF];
+    int connfd, n, off, rc;
+
+    pthread_detach(pthread_self());
+    while (1) {
+        if ((connfd = accept(metricsfd, NULL, NULL)) < 0) {
+            continue;
+        }
+        if (snapstatus(status, &snap) < 0) {
+            close(connfd);
+            continue;
+        }
+        n = formatmetrics(buf, sizeof(buf), snap.jobs);
+        for (off = 0; off < n; off += rc) {
+            if ((rc = write(connfd, buf + off, n - off)) <= 0) {
+                break;
+            }
+        }
+        close(connfd);
+    }
+    return NULL;
+}
+
+/*************************************
+ * Helper routines for event tracing
+ *************************************/
+
+/* 
+ * inittrace - Create and map the trace file. The mapping is shared,
+ *    so children record their setpgid and exec events into the same
+ *    ring until they exec. Records survive a crash of the shell.
+ */
+void inittrace(char *filename)
+{
+    int fd;
+    size_t size = sizeof(struct tracehdr_t) + TRACERECS * sizeof(struct tracerec_t);
+
+    if ((fd = open(filename, O_RDWR | O_CREAT | O_TRUNC, 0644)) < 0) {
+        unix_error("open trace file failed");
+    }
+    if (ftruncate(fd, size) < 0) {
+        unix_error("ftruncate trace file failed");
+    }
+    tracehdr = Mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+
+    tracering = (struct tracerec_t *)(tracehdr + 1);
+    tracehdr->version = TRACEVERSION;
+    tracehdr->recsize = sizeof(struct tracerec_t);
+    tracehdr->nrecs = TRACERECS;
+    tracehdr->head = 0;
+    __atomic_store_n(&tracehdr->magic, TRACEMAGIC, __ATOMIC_RELEASE);
+}
+
+/* 
+ * traceevent - Append one record to the trace ring. Async-signal-safe
+ *    and lock-free, so it may be called from handlers and children.
+ */
+void traceevent(int event, int arg0, int arg1, int arg2)
+{
+    unsigned long long slot;
+    struct tracerec_t *rec;
+
+    if (tracehdr == NULL) {
+        return;
+    }
+
+    slot = __atomic_fetch_add(&tracehdr->head, 1, __ATOMIC_RELAXED);
+    rec = &tracering[slot & (TRACERECS - 1)];
+    __atomic_store_n(&rec->seq, 0, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    rec->ns = nowns();
+    rec->pid = getpid();
+    rec->event = event;
+    rec->arg[0] = arg0;
+    rec->arg[1] = arg1;
+    rec->arg[2] = arg2;
+    __atomic_store_n(&rec->seq, (unsigned int)slot + 1, __ATOMIC_RELEASE);
+}
+
+/*************************************
+ * Helper routines for perfstat jobs
+ *************************************/
+
+/* 
+ * perfopen - Open one counter for process pid and everything it forks.
+ *    The counter starts at the child's exec. Returns -1 if the event
+ *    is unavailable.
+ */
+int perfopen(int type, int config, pid_t pid)
+{
+    struct perf_event_attr attr;
+    int fd;
+
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = type;
+    attr.config = config;
+    attr.disabled = 1;
+    attr.enable_on_exec = 1;
+    attr.inherit = 1;
+    attr.exclude_hv = 1;
+    attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+
+    fd = syscall(SYS_perf_event_open, &attr, pid, -1, -1, PERF_FLAG_FD_CLOEXEC);
+    if (fd < 0 && errno == EACCES) {
+        /* perf_event_paranoid may only allow user-space counting */
+        attr.exclude_kernel = 1;
+        fd = syscall(SYS_perf_event_open, &attr, pid, -1, -1, PERF_FLAG_FD_CLOEXEC);
+    }
+    return fd;
+}
+
+/* 
+ * attachperf - Open the perfstat counters for a job whose child is
+ *    still waiting to exec. Hardware counters that cannot be opened
+ *    fall back to their software equivalent where there is one.
+ */
+void attachperf(struct job_t *job)
+{
+    int i;
+    struct perfctr_t *ctr;
+
+    if (job == NULL) {
+        return;
+    }
+    job->perf = 1;
+    for (i = 0; i < NPERF; i++) {
+        ctr = &perfctrs[i];
+        job->perffd[i] = perfopen(ctr->type, ctr->config, job->pid);
+        if (job->perffd[i] < 0 && ctr->swname != NULL) {
+            job->perffd[i] = perfopen(PERF_TYPE_SOFTWARE, ctr->swconfig, job->pid);
+            if (job->perffd[i] >= 0) {
+                job->perfsw |= 1 << i;
+            }
+        }
+    }
+}
+
+/* 
+ * reportperf - Print the counters and rusage of a perfstat job that
+ *    has just been reaped. Counts are scaled when the kernel had to
+ *    multiplex the counters.
+ */
+void reportperf(struct job_t *job, struct rusage *ru)
+{
+    int i;
+    unsigned long long val[3]; /* value, time enabled, time running */
+    double count;
+    char *name;
+
+    printf("Job [%d] (%d) perfstat:\n", job->jid, job->pid);
+    for (i = 0; i < NPERF; i++) {
+        name = (job->perfsw & (1 << i)) ? perfctrs[i].swname : perfctrs[i].name;
+        if (job->perffd[i] < 0 || read(job->perffd[i], val, sizeof(val)) != sizeof(val)) {
+            printf("  %-18s <not supported>\n", name);
+            continue;
+        }
+        if (val[2] == 0) {
+            printf("  %-18s <not counted>\n", name);
+            continue;
+        }
+        count = (double)val[0];
+        if (val[2] < val[1]) {
+            count = count * val[1] / val[2];
+        }
+        /* the clock events count nanoseconds */
+        if ((perfctrs[i].type == PERF_TYPE_SOFTWARE &&
+             perfctrs[i].config == PERF_COUNT_SW_TASK_CLOCK) ||
+            (job->perfsw & (1 << i))) {
+            printf("  %-18s %.3f ms\n", name, count / 1e6);
+        } else {
+            printf("  %-18s %.0f\n", name, count);
+        }
+    }
+    printf("  %-18s %ld.%06lds\n", "user", (long)ru->ru_utime.tv_sec, (long)ru->ru_utime.tv_usec);
+    printf("  %-18s %ld.%06lds\n", "sys", (long)ru->ru_stime.tv_sec, (long)ru->ru_stime.tv_usec);
+    printf("  %-18s %ld KB\n", "maxrss", ru->ru_maxrss);
+    printf("  %-18s %ld/%ld\n", "faults (min/maj)", ru->ru_minflt, ru->ru_majflt);
+    printf("  %-18s %ld/%ld\n", "csw (vol/invol)", ru->ru_nvcsw, ru->ru_nivcsw);
+}
+
+/* closeperf - Release the counters of a job */
+void closeperf(struct job_t *job)
+{
+    int i;
+
+    for (i = 0; i < NPERF; i++) {
+        if (job->perffd[i] >= 0) {
+            close(job->perffd[i]);
+            job->perffd[i] = -1;
+        }
+    }
+}
 
 /***********************
  * Other helper routines
@@ -749,10 +1544,15 @@ void listjob(struct job_t *job)
  */
 void usage(void) 
 {
-    printf("Usage: shell [-hvp]\n");
+    printf("Usage: shell [-hvpsm] [-t <tracefile>]\n");
+    printf("       shell --status <pid>\n");
     printf("   -h   print this message\n");
     printf("   -v   print additional diagnostic information\n");
     printf("   -p   do not emit a command prompt\n");
+    printf("   -s   publish the job list in $XDG_RUNTIME_DIR/tsh/<pid>.status\n");
+    printf("   -m   serve metrics on the socket $XDG_RUNTIME_DIR/tsh/<pid>.metrics\n");
+    printf("   -t   record a binary event trace (see tshtrace)\n");
+    printf("   --status <pid>  print the job list published by shell <pid>\n");
     exit(1);
 }
 
@@ -848,4 +1648,13 @@ int Sigprocmask(int how, const sigset_t *set, sigset_t *oldset)
         unix_error("sigprocmask error");
     }
     return res;
+}
+
+void *Mmap(void *addr, size_t len, int prot, int flags, int fd, off_t offset)
+{
+    void *ptr = mmap(addr, len, prot, flags, fd, offset);
+    if (ptr == MAP_FAILED) {
+        unix_error("mmap error");
+    }
+    return ptr;
 }
\ No newline at end of file
@@ -0,0 +1,341 @@
+/*
+ * tshbench.c - Spawn and signal benchmarks for the tiny shell
+ *
+ * usage: tshbench [-h] [-s <shell>] [-m <myspin>] [-d <dir>] [-n <cmds>] [-r <rounds>]
+ * Drives a shell through pipes, the way a user at a terminal would,
+ * and prints the results as one JSON object on stdout:
+ *     fg_true      foreground /bin/true commands per second
+ *     bg_spawn     background /bin/true spawns per second
+ *     ctrl_c       SIGINT to the shell -> "terminated" message (us)
+ *     ctrl_z       SIGTSTP to the shell -> "stopped" message (us)
+ *     fg_resume    "fg %1" sent -> stopped job running again (us)
+ *     self_int     myint's kill(SIGINT) -> "terminated" message (us)
+ *     self_stop    mystop's kill(SIGTSTP) -> "stopped" message (us)
+ * Latencies are measured end to end, from the moment the signal or
+ * command is sent until its effect is observable from outside. For
+ * self_int and self_stop the job signals itself and writes the time
+ * of the kill to a FIFO, so they time only the shell's SIGCHLD path.
+ */
+#include "csapp.h"
+
+#define SETTLE_US   50000   /* time for a new foreground job to exec */
+#define TIMEOUT        60   /* seconds any one benchmark may take */
+
+struct shell_t {            /* A shell under test */
+    pid_t pid;              /* shell process */
+    int infd;               /* its stdin */
+    rio_t out;              /* its stdout and stderr */
+};
+
+char *shell = "./tsh";      /* shell under test */
+char *myspin = "./myspin";  /* spinning helper program */
+char *helpers = ".";        /* directory of myint and mystop */
+
+/* now - Return the monotonic clock in seconds */
+double now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* startshell - Start "shell -p" with its stdin and stdout on pipes */
+void startshell(struct shell_t *sh)
+{
+    int in[2], out[2];
+
+    if (pipe(in) < 0 || pipe(out) < 0)
+        unix_error("pipe error");
+    if ((sh->pid = Fork()) == 0) {
+        Dup2(in[0], 0);
+        Dup2(out[1], 1);
+        Close(in[0]);
+        Close(in[1]);
+        Close(out[0]);
+        Close(out[1]);
+        execl(shell, shell, "-p", (char *)NULL);
+        unix_error("execl error");
+    }
+    Close(in[0]);
+    Close(out[1]);
+    sh->infd = in[1];
+    Rio_readinitb(&sh->out, out[0]);
+}
+
+/* stopshell - Send EOF to the shell and wait for it to exit */
+void stopshell(struct shell_t *sh)
+{
+    char line[MAXBUF];
+
+    Close(sh->infd);
+    while (Rio_readlineb(&sh->out, line, sizeof(line)) > 0)
+        ;
+    Close(sh->out.rio_fd);
+    Waitpid(sh->pid, NULL, 0);
+}
+
+/* sendline - Write one command line to the shell */
+void sendline(struct shell_t *sh, char *cmd)
+{
+    char line[MAXBUF + 2];
+
+    snprintf(line, sizeof(line), "%s\n", cmd);
+    Rio_writen(sh->infd, line, strlen(line));
+}
+
+/* waitline - Read shell output until a line containing str, which is returned */
+char *waitline(struct shell_t *sh, char *str, char *line, size_t size)
+{
+    while (Rio_readlineb(&sh->out, line, size) > 0) {
+        if (strstr(line, str) != NULL)
+            return line;
+    }
+    app_error("tshbench: shell exited unexpectedly");
+    return NULL;
+}
+
+/* procstate - Return the scheduler state letter of a process */
+char procstate(pid_t pid)
+{
+    char path[64], buf[512], *p;
+    int fd, n;
+
+    snprintf(path, sizeof(path), "/proc/%d/stat", pid);
+    if ((fd = open(path, O_RDONLY)) < 0)
+        return 0;
+    n = read(fd, buf, sizeof(buf) - 1);
+    close(fd);
+    if (n <= 0)
+        return 0;
+    buf[n] = '\0';
+    if ((p = strrchr(buf, ')')) == NULL || p[1] == '\0')
+        return 0;
+    return p[2];
+}
+
+int cmpdouble(const void *a, const void *b)
+{
+    double x = *(double *)a, y = *(double *)b;
+    return x < y ? -1 : x > y;
+}
+
+/* printlatency - Print a latency distribution (seconds in, us out) */
+void printlatency(char *name, double *samples, int n, int last)
+{
+    int i;
+    double sum = 0;
+
+    qsort(samples, n, sizeof(double), cmpdouble);
+    for (i = 0; i < n; i++)
+        sum += samples[i];
+    printf("    \"%s\": {\"unit\": \"us\", \"samples\": %d, \"min\": %.1f, "
+           "\"median\": %.1f, \"p90\": %.1f, \"p99\": %.1f, \"max\": %.1f, "
+           "\"mean\": %.1f}%s\n", name, n, samples[0] * 1e6,
+           samples[n / 2] * 1e6, samples[n * 90 / 100] * 1e6,
+           samples[n * 99 / 100] * 1e6, samples[n - 1] * 1e6,
+           sum / n * 1e6, last ? "" : ",");
+}
+
+/* benchfg - Run n foreground /bin/true commands; returns seconds */
+double benchfg(int n)
+{
+    struct shell_t sh;
+    double start;
+    int i;
+
+    startshell(&sh);
+    start = now();
+    for (i = 0; i < n; i++)
+        sendline(&sh, "/bin/true");
+    stopshell(&sh);
+    return now() - start;
+}
+
+/* benchbg - Spawn n background /bin/true jobs; returns seconds */
+double benchbg(int n, int *spawned)
+{
+    struct shell_t sh;
+    char line[MAXBUF];
+    double start, secs;
+    int i;
+
+    startshell(&sh);
+    *spawned = 0;
+    start = now();
+    for (i = 0; i < n; i++)
+        sendline(&sh, "/bin/true &");
+    Close(sh.infd);
+    while (Rio_readlineb(&sh.out, line, sizeof(line)) > 0) {
+        if (line[0] == '[')
+            (*spawned)++;
+    }
+    secs = now() - start;
+    Close(sh.out.rio_fd);
+    Waitpid(sh.pid, NULL, 0);
+    return secs;
+}
+
+/*
+ * benchsignals - Measure rounds of ctrl-c, and of ctrl-z followed by
+ *    fg, against a foreground myspin job.
+ */
+void benchsignals(int rounds, double *intlat, double *stplat, double *fglat)
+{
+    struct shell_t sh;
+    char cmd[MAXBUF], line[MAXBUF];
+    double start;
+    pid_t pid;
+    int i;
+
+    snprintf(cmd, sizeof(cmd), "%s 30", myspin);
+    startshell(&sh);
+    for (i = 0; i < rounds; i++) {
+        /* ctrl-c */
+        sendline(&sh, cmd);
+        usleep(SETTLE_US);
+        start = now();
+        Kill(sh.pid, SIGINT);
+        waitline(&sh, "terminated", line, sizeof(line));
+        intlat[i] = now() - start;
+
+        /* ctrl-z */
+        sendline(&sh, cmd);
+        usleep(SETTLE_US);
+        start = now();
+        Kill(sh.pid, SIGTSTP);
+        waitline(&sh, "stopped", line, sizeof(line));
+        stplat[i] = now() - start;
+        if (sscanf(line, "Job [%*d] (%d)", &pid) != 1)
+            app_error("tshbench: cannot parse stopped job");
+        while (procstate(pid) != 'T')
+            ;
+
+        /* fg */
+        start = now();
+        sendline(&sh, "fg %1");
+        while (procstate(pid) == 'T')
+            ;
+        fglat[i] = now() - start;
+
+        Kill(sh.pid, SIGINT);
+        waitline(&sh, "terminated", line, sizeof(line));
+    }
+    stopshell(&sh);
+}
+
+/* readstamp - Read the next "<pid> <ns>" line of a helper; returns seconds */
+double readstamp(rio_t *rp)
+{
+    char line[MAX_LINE];
+    long long ns;
+
+    if (Rio_readlineb(rp, line, sizeof(line)) <= 0 ||
+        sscanf(line, "%*d %lld", &ns) != 1)
+        app_error("tshbench: bad timestamp from helper");
+    return ns / 1e9;
+}
+
+/*
+ * benchself - Measure rounds of foreground jobs that terminate or stop
+ *    themselves: a fresh myint per round, and one mystop that is put
+ *    back in the foreground after each stop.
+ */
+void benchself(int rounds, double *intlat, double *stplat)
+{
+    struct shell_t sh;
+    char fifo[64], cmd[MAXBUF], line[MAXBUF];
+    double stamp;
+    rio_t stamps;
+    int i, fd;
+
+    snprintf(fifo, sizeof(fifo), "/tmp/tshbench.%d.fifo", (int)getpid());
+    if (mkfifo(fifo, 0600) < 0)
+        unix_error("mkfifo error");
+    fd = Open(fifo, O_RDWR, 0);     /* never blocks, never sees EOF */
+    Rio_readinitb(&stamps, fd);
+    startshell(&sh);
+
+    snprintf(cmd, sizeof(cmd), "%s/myint -p %s 0", helpers, fifo);
+    for (i = 0; i < rounds; i++) {
+        sendline(&sh, cmd);
+        stamp = readstamp(&stamps);
+        waitline(&sh, "terminated", line, sizeof(line));
+        intlat[i] = now() - stamp;
+    }
+
+    snprintf(cmd, sizeof(cmd), "%s/mystop -p %s -r %d 0", helpers, fifo, rounds);
+    sendline(&sh, cmd);
+    for (i = 0; i < rounds; i++) {
+        stamp = readstamp(&stamps);
+        waitline(&sh, "stopped", line, sizeof(line));
+        stplat[i] = now() - stamp;
+        sendline(&sh, "fg %1");
+    }
+
+    stopshell(&sh);
+    Close(fd);
+    unlink(fifo);
+}
+
+void usage(char *prog)
+{
+    printf("Usage: %s [-h] [-s <shell>] [-m <myspin>] [-d <dir>] [-n <cmds>] [-r <rounds>]\n", prog);
+    printf("   -h           print this message\n");
+    printf("   -s <shell>   shell to benchmark (default ./tsh)\n");
+    printf("   -m <myspin>  path of the myspin helper (default ./myspin)\n");
+    printf("   -d <dir>     directory of the myint and mystop helpers (default .)\n");
+    printf("   -n <cmds>    commands per throughput benchmark (default 500)\n");
+    printf("   -r <rounds>  rounds per latency benchmark (default 20)\n");
+    exit(1);
+}
+
+int main(int argc, char **argv)
+{
+    int c, n = 500, rounds = 20, spawned;
+    double fgsecs, bgsecs, *intlat, *stplat, *fglat, *selfint, *selfstp;
+
+    while ((c = getopt(argc, argv, "hs:m:d:n:r:")) != EOF) {
+        switch (c) {
+        case 's': shell = optarg; break;
+        case 'm': myspin = optarg; break;
+        case 'd': helpers = optarg; break;
+        case 'n': n = atoi(optarg); break;
+        case 'r': rounds = atoi(optarg); break;
+        default:  usage(argv[0]);
+        }
+    }
+    if (n < 1 || rounds < 1)
+        usage(argv[0]);
+    intlat = Calloc(rounds, sizeof(double));
+    stplat = Calloc(rounds, sizeof(double));
+    fglat = Calloc(rounds, sizeof(double));
+    selfint = Calloc(rounds, sizeof(double));
+    selfstp = Calloc(rounds, sizeof(double));
+
+    Signal(SIGPIPE, SIG_IGN);
+    Alarm(TIMEOUT);
+    fgsecs = benchfg(n);
+    Alarm(TIMEOUT);
+    bgsecs = benchbg(n, &spawned);
+    Alarm(TIMEOUT);
+    benchsignals(rounds, intlat, stplat, fglat);
+    Alarm(TIMEOUT);
+    benchself(rounds, selfint, selfstp);
+    Alarm(0);
+
+    printf("{\n  \"shell\": \"%s\",\n  \"timestamp\": %ld,\n  \"results\": {\n",
+           shell, (long)time(NULL));
+    printf("    \"fg_true\": {\"unit\": \"cmds/s\", \"commands\": %d, "
+           "\"seconds\": %.6f, \"value\": %.1f},\n", n, fgsecs, n / fgsecs);
+    printf("    \"bg_spawn\": {\"unit\": \"spawns/s\", \"commands\": %d, "
+           "\"spawned\": %d, \"seconds\": %.6f, \"value\": %.1f},\n",
+           n, spawned, bgsecs, spawned / bgsecs);
+    printlatency("ctrl_c", intlat, rounds, 0);
+    printlatency("ctrl_z", stplat, rounds, 0);
+    printlatency("fg_resume", fglat, rounds, 0);
+    printlatency("self_int", selfint, rounds, 0);
+    printlatency("self_stop", selfstp, rounds, 1);
+    printf("  }\n}\n");
+    exit(0);
+}
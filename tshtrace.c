@@ -0,0 +1,125 @@
+/* 
+ * tshtrace.c - Convert a tsh binary event trace to Chrome trace-event JSON
+ * 
+ * usage: tshtrace <tracefile>
+ * Reads the ring written by tsh -t <tracefile> and prints a JSON
+ * document that chrome://tracing or Perfetto can load. Parse and
+ * waitfg intervals become duration events, everything else becomes
+ * an instant event on the track of the process that recorded it.
+ */
+#include "csapp.h"
+#include "trace.h"
+
+char *statename[] = {"undef", "fg", "bg", "stopped"};
+
+/* printargs - Print the args object for one record */
+void printargs(struct tracerec_t *rec)
+{
+    int status = rec->arg[1];
+
+    switch (rec->event) {
+    case TR_PARSE_END:
+        printf("{\"bg\":%d}", rec->arg[0]);
+        break;
+    case TR_FORK:
+    case TR_WAIT_BEGIN:
+    case TR_WAIT_END:
+        printf("{\"pid\":%d}", rec->arg[0]);
+        break;
+    case TR_SETPGID:
+        printf("{\"rc\":%d}", rec->arg[0]);
+        break;
+    case TR_SIGNAL:
+        printf("{\"pgid\":%d,\"signal\":\"%s\"}", rec->arg[0], strsignal(rec->arg[1]));
+        break;
+    case TR_REAP:
+        if (WIFEXITED(status))
+            printf("{\"pid\":%d,\"exited\":%d}", rec->arg[0], WEXITSTATUS(status));
+        else if (WIFSIGNALED(status))
+            printf("{\"pid\":%d,\"signaled\":%d}", rec->arg[0], WTERMSIG(status));
+        else if (WIFSTOPPED(status))
+            printf("{\"pid\":%d,\"stopped\":%d}", rec->arg[0], WSTOPSIG(status));
+        else
+            printf("{\"pid\":%d,\"status\":%d}", rec->arg[0], status);
+        break;
+    case TR_STATE:
+        printf("{\"pid\":%d,\"from\":\"%s\",\"to\":\"%s\"}", rec->arg[0],
+               (unsigned)rec->arg[1] < 4 ? statename[rec->arg[1]] : "?",
+               (unsigned)rec->arg[2] < 4 ? statename[rec->arg[2]] : "?");
+        break;
+    default:
+        printf("{}");
+    }
+}
+
+int main(int argc, char **argv) 
+{
+    int fd, n = 0;
+    struct stat st;
+    struct tracehdr_t *hdr;
+    struct tracerec_t *ring, rec;
+    unsigned long long slot, first, head, t0 = 0;
+    char *name, *ph;
+
+    if (argc != 2) {
+	fprintf(stderr, "Usage: %s <tracefile>\n", argv[0]);
+	exit(0);
+    }
+
+    fd = Open(argv[1], O_RDONLY, 0);
+    Fstat(fd, &st);
+    if (st.st_size < sizeof(struct tracehdr_t))
+	app_error("tshtrace: truncated trace file");
+    hdr = Mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    Close(fd);
+
+    if (hdr->magic != TRACEMAGIC || hdr->version != TRACEVERSION ||
+        hdr->recsize != sizeof(struct tracerec_t) ||
+        (hdr->nrecs & (hdr->nrecs - 1)) != 0 ||
+        st.st_size < sizeof(*hdr) + (off_t)hdr->nrecs * hdr->recsize)
+	app_error("tshtrace: not a tsh trace file");
+    ring = (struct tracerec_t *)(hdr + 1);
+
+    /* only the last nrecs records are still in the ring */
+    head = __atomic_load_n(&hdr->head, __ATOMIC_ACQUIRE);
+    first = head > hdr->nrecs ? head - hdr->nrecs : 0;
+
+    printf("{\"displayTimeUnit\":\"ns\",\"traceEvents\":[\n");
+    for (slot = first; slot < head; slot++) {
+	rec = ring[slot & (hdr->nrecs - 1)];
+	if (rec.seq != (unsigned int)(slot + 1))
+	    continue;   /* torn or overwritten record */
+	if (t0 == 0 || rec.ns < t0)
+	    t0 = rec.ns;
+    }
+    for (slot = first; slot < head; slot++) {
+	rec = ring[slot & (hdr->nrecs - 1)];
+	if (rec.seq != (unsigned int)(slot + 1))
+	    continue;
+
+	ph = "i";
+	switch (rec.event) {
+	case TR_PARSE_BEGIN: name = "parse";   ph = "B"; break;
+	case TR_PARSE_END:   name = "parse";   ph = "E"; break;
+	case TR_WAIT_BEGIN:  name = "waitfg";  ph = "B"; break;
+	case TR_WAIT_END:    name = "waitfg";  ph = "E"; break;
+	case TR_FORK:        name = "fork";    break;
+	case TR_SETPGID:     name = "setpgid"; break;
+	case TR_EXEC:        name = "exec";    break;
+	case TR_SIGNAL:      name = "signal";  break;
+	case TR_REAP:        name = "reap";    break;
+	case TR_STATE:       name = "state";   break;
+	default:             name = "unknown";
+	}
+
+	printf("%s{\"name\":\"%s\",\"ph\":\"%s\",%s\"ts\":%.3f,\"pid\":%d,\"tid\":%d,\"args\":",
+	       n++ ? ",\n" : "", name, ph, *ph == 'i' ? "\"s\":\"t\"," : "",
+	       (rec.ns - t0) / 1000.0, rec.pid, rec.pid);
+	printargs(&rec);
+	printf("}");
+    }
+    printf("\n]}\n");
+
+    Munmap(hdr, st.st_size);
+    exit(0);
+}